@@ -70,6 +70,36 @@ void mt76_set_irq_mask(struct mt76_dev *dev, u32 clear, u32 set)
 	spin_unlock_irqrestore(&dev->irq_lock, flags);
 }
 
+void mt76_irq_enable_mod(struct mt76_dev *dev, struct mt76_irq_mod *mod)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->irq_lock, flags);
+	dev->irqmask |= mod->mask;
+	mt76_wr(dev, MT_INT_MASK_CSR, dev->irqmask);
+	spin_unlock_irqrestore(&dev->irq_lock, flags);
+}
+
+/*
+ * Switch a direction between its per-ring done interrupt and the delay
+ * interrupt. If the old source is currently masked (NAPI running), the new
+ * one stays masked too and gets enabled when the poll completes.
+ */
+void mt76_irq_set_mod_mask(struct mt76_dev *dev, struct mt76_irq_mod *mod,
+			   u32 mask)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->irq_lock, flags);
+	if (dev->irqmask & mod->mask) {
+		dev->irqmask &= ~mod->mask;
+		dev->irqmask |= mask;
+		mt76_wr(dev, MT_INT_MASK_CSR, dev->irqmask);
+	}
+	mod->mask = mask;
+	spin_unlock_irqrestore(&dev->irq_lock, flags);
+}
+
 irqreturn_t mt76_irq_handler(int irq, void *dev_instance)
 {
 	struct mt76_dev *dev = dev_instance;
@@ -85,13 +115,15 @@ irqreturn_t mt76_irq_handler(int irq, void *dev_instance)
 
 	intr &= dev->irqmask;
 
-	if (intr & MT_INT_TX_DONE_ALL) {
-		mt76_irq_disable(dev, MT_INT_TX_DONE_ALL);
-		tasklet_schedule(&dev->tx_tasklet);
+	if (intr & (MT_INT_TX_DONE_ALL | MT_INT_TXDELAYINT)) {
+		dev->tx_mod.irqs++;
+		mt76_irq_disable(dev, MT_INT_TX_DONE_ALL | MT_INT_TXDELAYINT);
+		napi_schedule(&dev->tx_napi);
 	}
 
-	if (intr & MT_INT_RX_DONE(0)) {
-		mt76_irq_disable(dev, MT_INT_RX_DONE(0));
+	if (intr & (MT_INT_RX_DONE(0) | MT_INT_RXDELAYINT)) {
+		dev->rx_mod.irqs++;
+		mt76_irq_disable(dev, MT_INT_RX_DONE(0) | MT_INT_RXDELAYINT);
 		napi_schedule(&dev->napi);
 	}
 
@@ -103,13 +135,16 @@ irqreturn_t mt76_irq_handler(int irq, void *dev_instance)
 	if (intr & MT_INT_PRE_TBTT)
 		tasklet_schedule(&dev->pre_tbtt_tasklet);
 
-	/* send buffered multicast frames now */
+	/*
+	 * send buffered multicast frames now; the tasklet may be queueing
+	 * under q->lock, so don't touch the doorbell accounting here
+	 */
 	if (intr & MT_INT_TBTT)
-		mt76_kick_queue(dev, &dev->q_tx[MT_TXQ_PSD]);
+		__mt76_kick_queue(dev, &dev->q_tx[MT_TXQ_PSD]);
 
 	if (intr & MT_INT_TX_STAT) {
 		mt76_mac_poll_tx_status(dev, true);
-		tasklet_schedule(&dev->tx_tasklet);
+		napi_schedule(&dev->tx_napi);
 	}
 
 	return IRQ_HANDLED;
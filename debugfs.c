@@ -56,6 +56,8 @@ mt76_ampdu_stat_read(struct seq_file *file, void *data)
 		seq_puts(file, "\n");
 	}
 
+	seq_printf(file, "Average length: %u\n", dev->aggr_len);
+
 	return 0;
 }
 
@@ -72,6 +74,177 @@ static const struct file_operations fops_ampdu_stat = {
 	.release = single_release,
 };
 
+static void
+mt76_rx_pool_stat_show(struct seq_file *file, const char *name,
+		       struct mt76_queue *q)
+{
+	struct mt76_rx_pool *pool = &q->pool;
+	u32 total = pool->allocs + pool->fallback;
+
+	seq_printf(file, "%-4s pages: %4d recycled: %10u pool: %10u "
+		   "fallback: %10u", name, pool->n_pages, pool->recycled,
+		   pool->allocs, pool->fallback);
+	if (total)
+		seq_printf(file, " hit rate: %3u%%",
+			   (u32) div_u64(100ULL * pool->allocs, total));
+	seq_puts(file, "\n");
+}
+
+static int
+mt76_rx_pool_stat_read(struct seq_file *file, void *data)
+{
+	struct mt76_dev *dev = file->private;
+
+	mt76_rx_pool_stat_show(file, "data", &dev->q_rx);
+	mt76_rx_pool_stat_show(file, "mcu", &dev->mcu.q_rx);
+
+	return 0;
+}
+
+static int
+mt76_rx_pool_stat_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt76_rx_pool_stat_read, inode->i_private);
+}
+
+static const struct file_operations fops_rx_pool_stat = {
+	.open = mt76_rx_pool_stat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int
+mt76_tx_queue_stat_read(struct seq_file *file, void *data)
+{
+	struct mt76_dev *dev = file->private;
+	int i;
+
+	for (i = 0; i < MT_TXQ_MCU; i++) {
+		struct mt76_queue *q = &dev->q_tx[i];
+
+		seq_printf(file, "%d txwi inline: %10u fallback: %10u "
+			   "csum offload: %10u fallback: %10u "
+			   "bad dma idx: %u doorbells: %10u frames: %10u "
+			   "lock contended: %10u\n",
+			   i, q->txwi_inline, q->txwi_fallback,
+			   q->csum_offload, q->csum_fallback,
+			   q->dma_idx_invalid, q->doorbells,
+			   q->doorbell_frames, q->lock_contended);
+	}
+
+	return 0;
+}
+
+static int
+mt76_tx_queue_stat_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt76_tx_queue_stat_read, inode->i_private);
+}
+
+static const struct file_operations fops_tx_queue_stat = {
+	.open = mt76_tx_queue_stat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void
+mt76_irq_mod_show(struct seq_file *file, const char *name,
+		  struct mt76_irq_mod *mod)
+{
+	seq_printf(file, "%s profile: %d pint: %3d ptime: %3d "
+		   "irq/s: %8u frames/s: %8u\n",
+		   name, mod->profile, mod->pint, mod->ptime,
+		   mod->irq_rate, mod->frame_rate);
+}
+
+static int
+mt76_irq_mod_read(struct seq_file *file, void *data)
+{
+	struct mt76_dev *dev = file->private;
+
+	mt76_irq_mod_show(file, "rx", &dev->rx_mod);
+	mt76_irq_mod_show(file, "tx", &dev->tx_mod);
+
+	return 0;
+}
+
+static int
+mt76_irq_mod_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt76_irq_mod_read, inode->i_private);
+}
+
+static const struct file_operations fops_irq_mod = {
+	.open = mt76_irq_mod_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const char * const mt76_ac_names[] = {
+	[IEEE80211_AC_VO] = "vo",
+	[IEEE80211_AC_VI] = "vi",
+	[IEEE80211_AC_BE] = "be",
+	[IEEE80211_AC_BK] = "bk",
+};
+
+static int
+mt76_aql_stat_read(struct seq_file *file, void *data)
+{
+	struct mt76_dev *dev = file->private;
+	int i;
+
+	for (i = 0; i < IEEE80211_NUM_ACS; i++)
+		seq_printf(file, "%s pending: %8d low: %6u high: %6u "
+			   "throttled: %10u\n", mt76_ac_names[i],
+			   atomic_read(&dev->aql_pending[i]),
+			   dev->aql_limit_low[i], dev->aql_limit_high[i],
+			   dev->aql_throttled[i]);
+
+	return 0;
+}
+
+static int
+mt76_aql_stat_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt76_aql_stat_read, inode->i_private);
+}
+
+static const struct file_operations fops_aql_stat = {
+	.open = mt76_aql_stat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void
+mt76_init_aql_debugfs(struct mt76_dev *dev, struct dentry *parent)
+{
+	struct dentry *dir;
+	char name[16];
+	int i;
+
+	dir = debugfs_create_dir("aql", parent);
+	if (!dir)
+		return;
+
+	for (i = 0; i < IEEE80211_NUM_ACS; i++) {
+		snprintf(name, sizeof(name), "%s_low", mt76_ac_names[i]);
+		debugfs_create_u32(name, S_IRUSR | S_IWUSR, dir,
+				   &dev->aql_limit_low[i]);
+
+		snprintf(name, sizeof(name), "%s_high", mt76_ac_names[i]);
+		debugfs_create_u32(name, S_IRUSR | S_IWUSR, dir,
+				   &dev->aql_limit_high[i]);
+	}
+
+	debugfs_create_u32("threshold", S_IRUSR | S_IWUSR, dir,
+			   &dev->aql_threshold);
+	debugfs_create_file("stat", S_IRUSR, dir, dev, &fops_aql_stat);
+}
+
 void mt76_init_debugfs(struct mt76_dev *dev)
 {
 	struct dentry *dir;
@@ -86,4 +259,76 @@ void mt76_init_debugfs(struct mt76_dev *dev)
 	debugfs_create_u32("regidx", S_IRUSR | S_IWUSR, dir, &dev->debugfs_reg);
 	debugfs_create_file("regval", S_IRUSR | S_IWUSR, dir, dev, &fops_regval);
 	debugfs_create_file("ampdu_stat", S_IRUSR, dir, dev, &fops_ampdu_stat);
+	debugfs_create_file("rx_pool_stat", S_IRUSR, dir, dev,
+			    &fops_rx_pool_stat);
+	debugfs_create_file("tx_queue_stat", S_IRUSR, dir, dev,
+			    &fops_tx_queue_stat);
+	debugfs_create_file("irq_moderation", S_IRUSR, dir, dev,
+			    &fops_irq_mod);
+	debugfs_create_u32("rx_sta_checked", S_IRUSR, dir,
+			   &dev->rx_sta_checked);
+	debugfs_create_u32("rx_sta_mismatch", S_IRUSR, dir,
+			   &dev->rx_sta_mismatch);
+	debugfs_create_u32("txwi_seq_retry", S_IRUSR, dir,
+			   &dev->txwi_seq_retry);
+	debugfs_create_u32("burst_airtime", S_IRUSR | S_IWUSR, dir,
+			   &dev->burst_airtime);
+	debugfs_create_u32("tx_retry_requeued", S_IRUSR, dir,
+			   &dev->tx_retry_requeued);
+	debugfs_create_u32("tx_retry_expired", S_IRUSR, dir,
+			   &dev->tx_retry_expired);
+	debugfs_create_u32("tx_retry_recovered", S_IRUSR, dir,
+			   &dev->tx_retry_recovered);
+	debugfs_create_u32("tx_status_matched", S_IRUSR, dir,
+			   &dev->tx_status_matched);
+	debugfs_create_u32("tx_status_expired", S_IRUSR, dir,
+			   &dev->tx_status_expired);
+
+	mt76_init_aql_debugfs(dev, dir);
+}
+
+static int
+mt76_sta_airtime_read(struct seq_file *file, void *data)
+{
+	struct ieee80211_sta *sta = file->private;
+	struct mt76_sta *msta = (struct mt76_sta *) sta->drv_priv;
+	int i;
+
+	seq_printf(file, "retry airtime: %u\n", msta->wcid.airtime_retry);
+
+	for (i = 0; i < IEEE80211_NUM_ACS; i++)
+		seq_printf(file, "ac %d pending debt: %d\n", i,
+			   atomic_read(&msta->wcid.airtime_debt[i]));
+
+	for (i = 0; i < ARRAY_SIZE(sta->txq); i++) {
+		struct mt76_txq *mtxq;
+
+		if (!sta->txq[i])
+			continue;
+
+		mtxq = (struct mt76_txq *) sta->txq[i]->drv_priv;
+		seq_printf(file, "tid %2d airtime: %12llu deficit: %6d\n", i,
+			   (unsigned long long) mtxq->airtime, mtxq->deficit);
+	}
+
+	return 0;
+}
+
+static int
+mt76_sta_airtime_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt76_sta_airtime_read, inode->i_private);
+}
+
+static const struct file_operations fops_sta_airtime = {
+	.open = mt76_sta_airtime_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void mt76_sta_add_debugfs(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
+			  struct ieee80211_sta *sta, struct dentry *dir)
+{
+	debugfs_create_file("airtime", S_IRUSR, dir, sta, &fops_sta_airtime);
 }
@@ -14,12 +14,6 @@
 #include "mt76.h"
 #include "dma.h"
 
-struct mt76_txwi_cache {
-	struct mt76_txwi txwi;
-	dma_addr_t dma_addr;
-	struct list_head list;
-};
-
 static inline int
 mt76_rx_buf_offset(struct mt76_dev *dev)
 {
@@ -28,60 +22,14 @@ mt76_rx_buf_offset(struct mt76_dev *dev)
 	return MT_RX_HEADROOM - sizeof(struct mt76_rxwi);
 }
 
-static struct mt76_txwi_cache *
-mt76_alloc_txwi(struct mt76_dev *dev)
-{
-	struct mt76_txwi_cache *t;
-	dma_addr_t addr;
-	int size;
-
-	size = (sizeof(*t) + L1_CACHE_BYTES - 1) & ~(L1_CACHE_BYTES - 1);
-	t = devm_kzalloc(dev->dev, size, GFP_ATOMIC);
-	if (!t)
-		return NULL;
-
-	addr = dma_map_single(dev->dev, &t->txwi, sizeof(t->txwi), DMA_TO_DEVICE);
-	t->dma_addr = addr;
-
-	return t;
-}
-
-static struct mt76_txwi_cache *
-__mt76_get_txwi(struct mt76_dev *dev)
-{
-	struct mt76_txwi_cache *t = NULL;
-
-	spin_lock_bh(&dev->lock);
-	if (!list_empty(&dev->txwi_cache)) {
-		t = list_first_entry(&dev->txwi_cache, struct mt76_txwi_cache,
-				     list);
-		list_del(&t->list);
-	}
-	spin_unlock_bh(&dev->lock);
-
-	return t;
-}
-
-static struct mt76_txwi_cache *
-mt76_get_txwi(struct mt76_dev *dev)
-{
-	struct mt76_txwi_cache *t = __mt76_get_txwi(dev);
-
-	if (t)
-		return t;
-
-	return mt76_alloc_txwi(dev);
-}
-
-static void
-mt76_put_txwi(struct mt76_dev *dev, struct mt76_txwi_cache *t)
+/*
+ * RX_2B_OFFSET makes the DMA start writing data ring buffers 2 bytes in.
+ * MCU responses carry no 802.11 payload and are left aligned.
+ */
+static inline int
+mt76_rx_buf_shift(struct mt76_dev *dev, struct mt76_queue *q)
 {
-	if (!t)
-		return;
-
-	spin_lock_bh(&dev->lock);
-	list_add(&t->list, &dev->txwi_cache);
-	spin_unlock_bh(&dev->lock);
+	return dev->rx_2b_offset && q == &dev->q_rx ? 2 : 0;
 }
 
 static int
@@ -112,11 +60,24 @@ mt76_alloc_queue(struct mt76_dev *dev, struct mt76_queue *q)
 	return 0;
 }
 
-void mt76_kick_queue(struct mt76_dev *dev, struct mt76_queue *q)
+/* unconditional doorbell, safe without q->lock (TBTT interrupt) */
+void __mt76_kick_queue(struct mt76_dev *dev, struct mt76_queue *q)
 {
 	iowrite32(q->head, &q->regs->cpu_idx);
 }
 
+/* caller holds q->lock */
+void mt76_kick_queue(struct mt76_dev *dev, struct mt76_queue *q)
+{
+	if (!q->kick_pending)
+		return;
+
+	__mt76_kick_queue(dev, q);
+	q->doorbells++;
+	q->doorbell_frames += q->kick_pending;
+	q->kick_pending = 0;
+}
+
 static int
 mt76_queue_add_buf(struct mt76_dev *dev, struct mt76_queue *q,
 		   u32 buf0, int len0, u32 buf1, int len1, u32 info)
@@ -140,39 +101,166 @@ mt76_queue_add_buf(struct mt76_dev *dev, struct mt76_queue *q,
 	ACCESS_ONCE(desc->ctrl) = cpu_to_le32(ctrl);
 
 	q->queued++;
+	q->kick_pending++;
 
 	return idx;
 }
 
+static void
+mt76_rx_pool_cleanup(struct mt76_dev *dev, struct mt76_queue *q)
+{
+	struct mt76_rx_pool *pool = &q->pool;
+	int i;
+
+	for (i = 0; i < pool->n_pages; i++) {
+		struct mt76_rx_page *p = &pool->pages[i];
+
+		if (!p->page)
+			continue;
+
+		dma_unmap_page(dev->dev, p->dma_addr, PAGE_SIZE,
+			       DMA_FROM_DEVICE);
+		put_page(p->page);
+		p->page = NULL;
+	}
+}
+
+static int
+mt76_rx_pool_init(struct mt76_dev *dev, struct mt76_queue *q)
+{
+	struct mt76_rx_pool *pool = &q->pool;
+	int n_pages, size;
+	int i;
+
+	n_pages = DIV_ROUND_UP(2 * q->ndesc * q->buf_size, PAGE_SIZE);
+	size = n_pages * sizeof(*pool->pages);
+	pool->pages = devm_kzalloc(dev->dev, size, GFP_KERNEL);
+	if (!pool->pages)
+		return -ENOMEM;
+
+	/* only set once there is an array for mt76_rx_pool_cleanup to walk */
+	pool->n_pages = n_pages;
+
+	for (i = 0; i < pool->n_pages; i++) {
+		struct mt76_rx_page *p = &pool->pages[i];
+		struct page *page;
+		dma_addr_t addr;
+
+		page = alloc_page(GFP_KERNEL);
+		if (!page)
+			goto error;
+
+		addr = dma_map_page(dev->dev, page, 0, PAGE_SIZE,
+				    DMA_FROM_DEVICE);
+		if (dma_mapping_error(dev->dev, addr)) {
+			__free_page(page);
+			goto error;
+		}
+
+		p->page = page;
+		p->dma_addr = addr;
+	}
+
+	/* force a page lookup on the first allocation */
+	pool->cur = pool->n_pages - 1;
+	pool->offset = PAGE_SIZE;
+
+	return 0;
+
+error:
+	mt76_rx_pool_cleanup(dev, q);
+	return -ENOMEM;
+}
+
+/*
+ * Pool pages stay mapped for the lifetime of the queue. The pool holds one
+ * reference on each page, and every fragment handed to the hardware holds
+ * another one, which is passed on to the skb and dropped when the stack
+ * frees it. A page can be carved up again once only the pool reference is
+ * left.
+ */
+static void *
+mt76_rx_pool_get(struct mt76_queue *q, struct mt76_rx_page **rx_page,
+		 dma_addr_t *addr)
+{
+	struct mt76_rx_pool *pool = &q->pool;
+	struct mt76_rx_page *p;
+	void *buf;
+	int i;
+
+	if (pool->offset + q->buf_size > PAGE_SIZE) {
+		for (i = 0; i < pool->n_pages; i++) {
+			pool->cur = (pool->cur + 1) % pool->n_pages;
+			if (page_count(pool->pages[pool->cur].page) == 1)
+				break;
+		}
+
+		if (i == pool->n_pages)
+			return NULL;
+
+		p = &pool->pages[pool->cur];
+		if (p->used)
+			pool->recycled++;
+		p->used = true;
+
+		pool->offset = 0;
+	}
+
+	p = &pool->pages[pool->cur];
+	get_page(p->page);
+
+	buf = page_address(p->page) + pool->offset;
+	*addr = p->dma_addr + pool->offset;
+	*rx_page = p;
+
+	pool->offset += q->buf_size;
+	pool->allocs++;
+
+	return buf;
+}
+
 static int
 mt76_dma_rx_fill(struct mt76_dev *dev, struct mt76_queue *q)
 {
+	struct mt76_rx_page *rx_page;
 	dma_addr_t addr;
 	void *buf;
 	int frames = 0;
 	int len = SKB_WITH_OVERHEAD(q->buf_size);
+	int offset = mt76_rx_buf_offset(dev);
 	int idx;
 
 	spin_lock_bh(&q->lock);
 
 	while (q->queued < q->ndesc - 1) {
-		int offset = mt76_rx_buf_offset(dev);
-
-		buf = kzalloc(len, GFP_ATOMIC);
-		if (!buf)
-			break;
-
-		addr = dma_map_single(dev->dev, buf, len, DMA_FROM_DEVICE);
-
-		if (dma_mapping_error(dev->dev, addr)) {
-			kfree(buf);
-			break;
+		buf = mt76_rx_pool_get(q, &rx_page, &addr);
+		if (buf) {
+			dma_sync_single_range_for_device(dev->dev,
+				rx_page->dma_addr, addr - rx_page->dma_addr,
+				len, DMA_FROM_DEVICE);
+		} else {
+			rx_page = NULL;
+			buf = netdev_alloc_frag(q->buf_size);
+			if (!buf)
+				break;
+
+			addr = dma_map_single(dev->dev, buf, len,
+					      DMA_FROM_DEVICE);
+			if (dma_mapping_error(dev->dev, addr)) {
+				put_page(virt_to_head_page(buf));
+				break;
+			}
+
+			q->pool.fallback++;
 		}
 
-		idx = mt76_queue_add_buf(dev, q, addr + offset, len - offset,
+		idx = mt76_queue_add_buf(dev, q, addr + offset,
+					 len - offset - mt76_rx_buf_shift(dev, q),
 					 0, 0, 0);
 
 		q->entry[idx].buf = buf;
+		q->entry[idx].rx_page = rx_page;
+		q->entry[idx].dma_addr = addr;
 		frames++;
 	}
 
@@ -198,6 +286,7 @@ int __mt76_tx_queue_skb(struct mt76_dev *dev, enum mt76_txq_id qid,
 	spin_lock_bh(&q->lock);
 	idx = mt76_queue_add_buf(dev, q, addr, skb->len, 0, 0, tx_info);
 	q->entry[idx].skb = skb;
+	q->entry[idx].dma_addr = addr;
 	mt76_kick_queue(dev, q);
 	spin_unlock_bh(&q->lock);
 
@@ -209,32 +298,29 @@ int mt76_tx_queue_skb(struct mt76_dev *dev, struct mt76_queue *q,
 		      struct ieee80211_sta *sta)
 {
 	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
-	struct mt76_txwi_cache *t;
-	dma_addr_t addr;
+	struct mt76_txwi txwi, *txwi_ptr;
+	dma_addr_t addr, txwi_addr;
+	int qid = q - dev->q_tx;
 	u32 tx_info = 0;
+	u32 airtime;
 	int idx, ret, len;
 	int qsel = MT_QSEL_EDCA;
+	u8 pktid;
 
-	ret = -ENOMEM;
-	t = mt76_get_txwi(dev);
-	if (!t)
-		goto free;
-
-	dma_sync_single_for_cpu(dev->dev, t->dma_addr, sizeof(t->txwi),
-				DMA_TO_DEVICE);
-	mt76_mac_write_txwi(dev, &t->txwi, skb, wcid, sta);
-	dma_sync_single_for_device(dev->dev, t->dma_addr, sizeof(t->txwi),
-				   DMA_TO_DEVICE);
+	pktid = mt76_mac_tx_status_add(dev, wcid, skb);
+	mt76_mac_write_txwi(dev, &txwi, skb, wcid, sta, pktid);
 
-	ret = mt76_insert_hdr_pad(skb);
-	if (ret)
-		goto put_txwi;
+	if (!dev->tx_l2_stuff) {
+		ret = mt76_insert_hdr_pad(skb);
+		if (ret)
+			goto free;
+	}
 
 	if (info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE)
 		qsel = 0;
 
-	len = skb->len + sizeof(t->txwi);
-	len += mt76_mac_skb_tx_overhead(dev, skb);
+	len = skb->len + sizeof(txwi);
+	len += mt76_skb_tx_info(skb)->overhead;
 	tx_info = MT76_SET(MT_TXD_INFO_LEN, len) |
 		  MT76_SET(MT_TXD_INFO_QSEL, qsel) |
 		  MT_TXD_INFO_80211;
@@ -242,113 +328,252 @@ int mt76_tx_queue_skb(struct mt76_dev *dev, struct mt76_queue *q,
 	if (!wcid || wcid->hw_key_idx < 0)
 		tx_info |= MT_TXD_INFO_WIV;
 
-	addr = dma_map_single(dev->dev, skb->data, skb->len, DMA_TO_DEVICE);
-	if (dma_mapping_error(dev->dev, addr))
-		goto put_txwi;
+	airtime = mt76_mac_tx_airtime(txwi.rate, le16_to_cpu(txwi.len_ctl),
+		txwi.flags & cpu_to_le16(MT_TXWI_FLAGS_AMPDU));
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		u32 csum = mt76_mac_tx_csum_info(skb);
+
+		if (csum) {
+			tx_info |= csum;
+			q->csum_offload++;
+		} else {
+			ret = skb_checksum_help(skb);
+			if (ret)
+				goto free;
+			q->csum_fallback++;
+		}
+	}
+
+	/*
+	 * extra_tx_headroom leaves room for the TXWI in front of the frame,
+	 * so it can go out as a single buffer. Cloned skbs share their
+	 * headroom and use the TXWI ring slot instead, as do frames whose
+	 * header is left unpadded for L2 stuffing: their TXWI would not be
+	 * 4 byte aligned.
+	 */
+	if (!skb_cloned(skb) && skb_headroom(skb) >= sizeof(txwi) &&
+	    IS_ALIGNED((unsigned long) skb->data - sizeof(txwi), 4)) {
+		txwi_ptr = (struct mt76_txwi *) skb_push(skb, sizeof(txwi));
+		*txwi_ptr = txwi;
+
+		ret = -ENOMEM;
+		addr = dma_map_single(dev->dev, skb->data, skb->len,
+				      DMA_TO_DEVICE);
+		if (dma_mapping_error(dev->dev, addr)) {
+			skb_pull(skb, sizeof(txwi));
+			goto free;
+		}
+
+		idx = mt76_queue_add_buf(dev, q, addr, skb->len, 0, 0, tx_info);
+		q->entry[idx].txwi_inline = true;
+		q->txwi_inline++;
+	} else {
+		/* TXWI buffers are indexed by ring slot, caller holds q->lock */
+		txwi_ptr = &q->txwi[q->head];
+		txwi_addr = q->txwi_dma + q->head * sizeof(txwi);
+		*txwi_ptr = txwi;
+
+		ret = -ENOMEM;
+		addr = dma_map_single(dev->dev, skb->data, skb->len,
+				      DMA_TO_DEVICE);
+		if (dma_mapping_error(dev->dev, addr))
+			goto free;
+
+		idx = mt76_queue_add_buf(dev, q, txwi_addr, sizeof(txwi),
+					 addr, skb->len, tx_info);
+		q->txwi_fallback++;
+	}
 
-	idx = mt76_queue_add_buf(dev, q, t->dma_addr, sizeof(t->txwi),
-				 addr, skb->len, tx_info);
 	q->entry[idx].skb = skb;
-	q->entry[idx].txwi = t;
+	q->entry[idx].dma_addr = addr;
+	q->entry[idx].bytes = skb->len;
+	q->entry[idx].airtime = min_t(u32, airtime, U16_MAX);
+	q->entry[idx].txwi = txwi_ptr;
+	q->entry[idx].wcid = txwi.wcid;
+	q->entry[idx].pktid = txwi.pktid;
+	dql_queued(&q->dql, skb->len);
+
+	if (qid < IEEE80211_NUM_ACS && wcid &&
+	    wcid->idx < ARRAY_SIZE(dev->wcid)) {
+		airtime = q->entry[idx].airtime;
+		q->entry[idx].wcid_gen = wcid->gen;
+		wcid->last_ac = qid;
+		atomic_add(airtime, &wcid->airtime_pending[qid]);
+		atomic_add(airtime, &dev->aql_pending[qid]);
+	}
 
 	return idx;
 
-put_txwi:
-	mt76_put_txwi(dev, t);
 free:
+	if (pktid >= MT_PKTID_FIRST)
+		skb_unlink(skb, &dev->status_list);
 	ieee80211_free_txskb(dev->hw, skb);
 	return ret;
 }
 
+/*
+ * Returns the number of entries starting at q->tail that the hardware is
+ * done with (all queued entries on flush), capped at max. The DMA index is
+ * read once per pass; DMA_DONE bits are only walked if it is out of range.
+ * Caller holds q->lock.
+ */
 static int
-mt76_dma_dequeue(struct mt76_dev *dev, struct mt76_queue *q, bool flush)
+mt76_dma_dequeue(struct mt76_dev *dev, struct mt76_queue *q, bool flush,
+		 int max)
 {
-	int ret = -1;
+	int dma_idx, n;
 
-	spin_lock_bh(&q->lock);
+	if (flush || !q->queued)
+		return min(q->queued, max);
 
-	if (!q->queued)
-		goto out;
+	dma_idx = ioread32(&q->regs->dma_idx);
+	n = (dma_idx + q->ndesc - q->tail) % q->ndesc;
+	if (dma_idx < q->ndesc && n <= q->queued && (n || q->queued < q->ndesc))
+		return min(n, max);
 
-	if (!flush && !(q->desc[q->tail].ctrl & cpu_to_le32(MT_DMA_CTL_DMA_DONE)))
-		goto out;
+	q->dma_idx_invalid++;
+	for (n = 0; n < q->queued && n < max; n++) {
+		struct mt76_desc *desc = &q->desc[(q->tail + n) % q->ndesc];
 
-	ret = q->tail;
-	q->tail = (q->tail + 1) % q->ndesc;
-	q->queued--;
+		if (!(desc->ctrl & cpu_to_le32(MT_DMA_CTL_DMA_DONE)))
+			break;
+	}
 
-out:
-	spin_unlock_bh(&q->lock);
-	return ret;
+	return n;
 }
 
+/* Return the airtime of a completed frame to its station's AQL budget */
 static void
-mt76_tx_cleanup_entry(struct mt76_dev *dev, struct mt76_queue *q, int idx,
-		      bool flush)
+mt76_tx_aql_release(struct mt76_dev *dev, int qid, struct mt76_queue_entry *e)
+{
+	struct mt76_wcid *wcid;
+
+	if (qid >= IEEE80211_NUM_ACS || e->wcid >= ARRAY_SIZE(dev->wcid))
+		return;
+
+	atomic_sub(e->airtime, &dev->aql_pending[qid]);
+
+	/* the index may have been handed to a new station in the meantime */
+	wcid = rcu_dereference(dev->wcid[e->wcid]);
+	if (wcid && wcid->gen == e->wcid_gen)
+		atomic_sub(e->airtime, &wcid->airtime_pending[qid]);
+}
+
+static bool
+mt76_tx_cleanup_entry(struct mt76_dev *dev, struct mt76_queue *q, int idx)
 {
 	struct mt76_queue_entry *e = &q->entry[idx];
 	struct sk_buff *skb = e->skb;
-	struct mt76_txwi_cache *txwi = e->txwi;
-	dma_addr_t skb_addr;
+	struct mt76_txwi *txwi = e->txwi;
 	bool schedule = e->schedule;
 
-	if (txwi)
-		skb_addr = ACCESS_ONCE(q->desc[idx].buf1);
-	else
-		skb_addr = ACCESS_ONCE(q->desc[idx].buf0);
+	dma_unmap_single(dev->dev, e->dma_addr, skb->len, DMA_TO_DEVICE);
+	if (e->txwi_inline)
+		skb_pull(skb, sizeof(*txwi));
 
-	dma_unmap_single(dev->dev, skb_addr, skb->len, DMA_TO_DEVICE);
 	e->skb = NULL;
 	e->txwi = NULL;
 	e->schedule = false;
+	e->txwi_inline = false;
 
-	if (txwi) {
-		skb_orphan(skb);
-		mt76_mac_queue_txdone(dev, skb, &txwi->txwi);
-		mt76_put_txwi(dev, txwi);
-
-		if (schedule) {
-			spin_lock_bh(&q->lock);
-			q->swq_queued--;
-			if (!flush)
-				mt76_txq_schedule(dev, q);
-			spin_unlock_bh(&q->lock);
-		}
-	} else {
+	if (!txwi) {
 		dev_kfree_skb_any(skb);
+		return false;
 	}
+
+	skb_orphan(skb);
+	mt76_mac_queue_txdone(dev, skb, e->wcid, e->pktid);
+
+	return schedule;
 }
 
-static void
-mt76_tx_cleanup_queue(struct mt76_dev *dev, struct mt76_queue *q, bool flush)
+/*
+ * Reap up to budget completed entries. The range is claimed under a single
+ * q->lock, processed unlocked (the producer never touches slots between
+ * tail and head - queued) and released again in one go.
+ */
+static int
+mt76_tx_cleanup_queue(struct mt76_dev *dev, struct mt76_queue *q, bool flush,
+		      int budget)
 {
-	int idx;
+	int qid = q - dev->q_tx;
+	int n_done, n_sched = 0;
+	unsigned int bytes = 0;
+	bool wake;
+	int idx, i;
 
-	do {
-		idx = mt76_dma_dequeue(dev, q, flush);
-		if (idx < 0)
-			break;
+	mt76_queue_lock(q);
+	idx = q->tail;
+	n_done = mt76_dma_dequeue(dev, q, flush, budget);
+	mt76_queue_unlock(q);
+
+	if (!n_done)
+		return 0;
+
+	rcu_read_lock();
+	for (i = 0; i < n_done; i++) {
+		bytes += q->entry[idx].bytes;
+		q->entry[idx].bytes = 0;
+
+		mt76_tx_aql_release(dev, qid, &q->entry[idx]);
+		q->entry[idx].airtime = 0;
+
+		if (mt76_tx_cleanup_entry(dev, q, idx))
+			n_sched++;
+
+		idx = (idx + 1) % q->ndesc;
+	}
+	rcu_read_unlock();
+
+	mt76_queue_lock(q);
+	q->tail = idx;
+	q->queued -= n_done;
+	q->swq_queued -= n_sched;
+	dql_completed(&q->dql, bytes);
 
-		mt76_tx_cleanup_entry(dev, q, idx, flush);
-	} while (1);
+	if (flush)
+		dql_reset(&q->dql);
+	else if (n_sched || !list_empty(&q->swq))
+		mt76_txq_schedule(dev, q);
+
+	wake = !flush && qid < IEEE80211_NUM_ACS &&
+	       q->queued < q->ndesc - 8 && dql_avail(&q->dql) >= 0;
+	mt76_queue_unlock(q);
+
+	if (wake)
+		ieee80211_wake_queue(dev->hw, qid);
+
+	return n_done;
 }
 
 static void *
 mt76_rx_get_buf(struct mt76_dev *dev, struct mt76_queue *q, int idx, int *len)
 {
 	struct mt76_queue_entry *e;
+	struct mt76_rx_page *rx_page;
 	dma_addr_t buf_addr;
+	int buf_len = SKB_WITH_OVERHEAD(q->buf_size);
 	void *buf;
 
 	e = &q->entry[idx];
 	buf = e->buf;
-	buf_addr = ACCESS_ONCE(q->desc[idx].buf0);
+	rx_page = e->rx_page;
+	buf_addr = e->dma_addr;
 	if (len) {
-		u32 ctl = ACCESS_ONCE(q->desc[idx].ctrl);
+		u32 ctl = le32_to_cpu(ACCESS_ONCE(q->desc[idx].ctrl));
 		*len = MT76_GET(MT_DMA_CTL_SD_LEN0, ctl);
 	}
-	dma_unmap_single(dev->dev, buf_addr, q->buf_size, DMA_FROM_DEVICE);
+
+	if (rx_page)
+		dma_sync_single_range_for_cpu(dev->dev, rx_page->dma_addr,
+					      buf_addr - rx_page->dma_addr,
+					      buf_len, DMA_FROM_DEVICE);
+	else
+		dma_unmap_single(dev->dev, buf_addr, buf_len, DMA_FROM_DEVICE);
+
 	e->buf = NULL;
+	e->rx_page = NULL;
 
 	return buf;
 }
@@ -357,16 +582,22 @@ static void
 mt76_rx_cleanup(struct mt76_dev *dev, struct mt76_queue *q)
 {
 	void *buf;
-	int idx;
+	int idx, n;
 
-	do {
-		idx = mt76_dma_dequeue(dev, q, true);
-		if (idx < 0)
-			break;
+	spin_lock_bh(&q->lock);
+	idx = q->tail;
+	n = mt76_dma_dequeue(dev, q, true, q->ndesc);
+	q->tail = (q->tail + n) % q->ndesc;
+	q->queued -= n;
+	spin_unlock_bh(&q->lock);
 
+	while (n--) {
 		buf = mt76_rx_get_buf(dev, q, idx, NULL);
-		kfree(buf);
-	} while (1);
+		put_page(virt_to_head_page(buf));
+		idx = (idx + 1) % q->ndesc;
+	}
+
+	mt76_rx_pool_cleanup(dev, q);
 }
 
 static int
@@ -377,6 +608,7 @@ mt76_init_tx_queue(struct mt76_dev *dev, struct mt76_queue *q,
 
 	q->regs = dev->regs + MT_TX_RING_BASE + idx * MT_RING_SIZE;
 	q->ndesc = n_desc;
+	dql_init(&q->dql, HZ);
 
 	ret = mt76_alloc_queue(dev, q);
 	if (ret)
@@ -387,9 +619,37 @@ mt76_init_tx_queue(struct mt76_dev *dev, struct mt76_queue *q,
 	return 0;
 }
 
+static int
+mt76_alloc_txwi(struct mt76_dev *dev)
+{
+	struct mt76_txwi *txwi;
+	dma_addr_t addr;
+	int i, size, n_desc = 0;
+
+	for (i = 0; i < MT_TXQ_MCU; i++)
+		n_desc += dev->q_tx[i].ndesc;
+
+	size = n_desc * sizeof(*txwi);
+	txwi = dmam_alloc_coherent(dev->dev, size, &addr, GFP_KERNEL);
+	if (!txwi)
+		return -ENOMEM;
+
+	for (i = 0; i < MT_TXQ_MCU; i++) {
+		struct mt76_queue *q = &dev->q_tx[i];
+
+		q->txwi = txwi;
+		q->txwi_dma = addr;
+
+		txwi += q->ndesc;
+		addr += q->ndesc * sizeof(*txwi);
+	}
+
+	return 0;
+}
+
 static void
 mt76_process_rx_skb(struct mt76_dev *dev, struct mt76_queue *q,
-		    struct sk_buff *skb, u32 info)
+		    struct sk_buff *skb, u32 info, struct sk_buff_head *frames)
 {
 	void *rxwi = skb->data - sizeof(struct mt76_rxwi);
 
@@ -413,39 +673,48 @@ mt76_process_rx_skb(struct mt76_dev *dev, struct mt76_queue *q,
 	    return;
 	}
 
-	mt76_rx(dev, skb);
+	__skb_queue_tail(frames, skb);
 }
 
 static int
 mt76_process_rx_queue(struct mt76_dev *dev, struct mt76_queue *q, int budget)
 {
+	struct sk_buff_head frames;
 	struct mt76_desc *desc;
 	struct sk_buff *skb;
 	unsigned char *data;
-	int idx, len;
-	int done = 0;
+	int idx, len, i;
+	int done;
 
-	while (done < budget) {
-		idx = mt76_dma_dequeue(dev, q, false);
-		if (idx < 0)
-			break;
+	__skb_queue_head_init(&frames);
+
+	spin_lock_bh(&q->lock);
+	idx = q->tail;
+	done = mt76_dma_dequeue(dev, q, false, budget);
+	q->tail = (q->tail + done) % q->ndesc;
+	q->queued -= done;
+	spin_unlock_bh(&q->lock);
 
+	for (i = 0; i < done; i++, idx = (idx + 1) % q->ndesc) {
 		data = mt76_rx_get_buf(dev, q, idx, &len);
-		skb = build_skb(data, 0);
+		skb = build_skb(data, q->buf_size);
 		if (!skb) {
-			kfree(data);
+			put_page(virt_to_head_page(data));
 			continue;
 		}
 
-		skb_reserve(skb, MT_RX_HEADROOM);
+		skb_reserve(skb, MT_RX_HEADROOM + mt76_rx_buf_shift(dev, q));
 		skb_put(skb, len);
 
 		desc = &q->desc[idx];
-		mt76_process_rx_skb(dev, q, skb, le32_to_cpu(desc->info));
-		done++;
+		mt76_process_rx_skb(dev, q, skb, le32_to_cpu(desc->info),
+				    &frames);
 	}
 
+	/* refill first, so the ring is not starved while the stack runs */
 	mt76_dma_rx_fill(dev, q);
+	mt76_rx_complete(dev, &frames);
+
 	return done;
 }
 
@@ -463,24 +732,45 @@ mt76_init_rx_queue(struct mt76_dev *dev, struct mt76_queue *q,
 	if (ret)
 		return ret;
 
+	ret = mt76_rx_pool_init(dev, q);
+	if (ret)
+		return ret;
+
 	mt76_irq_enable(dev, MT_INT_RX_DONE(idx));
 
 	return 0;
 }
 
-static void
-mt76_tx_tasklet(unsigned long data)
+static int
+mt76_dma_tx_poll(struct napi_struct *napi, int budget)
 {
-	struct mt76_dev *dev = (struct mt76_dev *) data;
-	int i;
+	struct mt76_dev *dev = container_of(napi, struct mt76_dev, tx_napi);
+	int i, done, max_done = 0, total = 0;
 
 	mt76_mac_process_tx_status_fifo(dev);
+	mt76_mac_poll_tx_status(dev, false);
 
-	for (i = ARRAY_SIZE(dev->q_tx) - 1; i >= 0; i--)
-		mt76_tx_cleanup_queue(dev, &dev->q_tx[i], false);
+	for (i = ARRAY_SIZE(dev->q_tx) - 1; i >= 0; i--) {
+		done = mt76_tx_cleanup_queue(dev, &dev->q_tx[i], false,
+					     budget);
+		max_done = max(max_done, done);
+		total += done;
+	}
 
 	mt76_mac_poll_tx_status(dev, false);
-	mt76_irq_enable(dev, MT_INT_TX_DONE_ALL);
+	mt76_mac_tx_status_check(dev, false);
+
+	dev->tx_mod.polls++;
+	dev->tx_mod.frames += total;
+
+	if (max_done < budget) {
+		napi_complete(napi);
+		mt76_irq_enable_mod(dev, &dev->tx_mod);
+	} else {
+		dev->tx_mod.full_polls++;
+	}
+
+	return min(max_done, budget);
 }
 
 static int
@@ -491,9 +781,14 @@ mt76_dma_rx_poll(struct napi_struct *napi, int budget)
 
 	done = mt76_process_rx_queue(dev, &dev->q_rx, budget);
 
+	dev->rx_mod.polls++;
+	dev->rx_mod.frames += done;
+
 	if (done < budget) {
 		napi_complete(napi);
-		mt76_irq_enable(dev, MT_INT_RX_DONE(0));
+		mt76_irq_enable_mod(dev, &dev->rx_mod);
+	} else {
+		dev->rx_mod.full_polls++;
 	}
 
 	return done;
@@ -533,7 +828,9 @@ int mt76_dma_init(struct mt76_dev *dev)
 	init_dummy_netdev(&dev->napi_dev);
 	netif_napi_add(&dev->napi_dev, &dev->napi, mt76_dma_rx_poll, 64);
 
-	tasklet_init(&dev->tx_tasklet, mt76_tx_tasklet, (unsigned long) dev);
+	netif_napi_add(&dev->napi_dev, &dev->tx_napi, mt76_dma_tx_poll,
+		       NAPI_POLL_WEIGHT);
+
 	tasklet_init(&dev->rx_tasklet, mt76_rx_tasklet, (unsigned long) dev);
 
 	mt76_wr(dev, MT_WPDMA_RST_IDX, ~0);
@@ -542,48 +839,60 @@ int mt76_dma_init(struct mt76_dev *dev)
 		ret = mt76_init_tx_queue(dev, &dev->q_tx[i], wmm_queue_map[i],
 					 MT_TX_RING_SIZE, false);
 		if (ret)
-			return ret;
+			goto error;
 	}
 
 	ret = mt76_init_tx_queue(dev, &dev->q_tx[MT_TXQ_PSD],
 				 MT_TX_HW_QUEUE_MGMT, MT_TX_RING_SIZE, false);
 	if (ret)
-		return ret;
+		goto error;
 
 	ret = mt76_init_tx_queue(dev, &dev->q_tx[MT_TXQ_MCU],
 				 MT_TX_HW_QUEUE_MCU, MT_MCU_RING_SIZE, true);
 	if (ret)
-		return ret;
+		goto error;
+
+	ret = mt76_alloc_txwi(dev);
+	if (ret)
+		goto error;
 
 	ret = mt76_init_rx_queue(dev, &dev->mcu.q_rx, 1, MT_MCU_RING_SIZE,
 				 MT_RX_BUF_SIZE);
 	if (ret)
-		return ret;
+		goto error;
 
 	ret = mt76_init_rx_queue(dev, &dev->q_rx, 0,
 				 MT_RX_RING_SIZE, MT_RX_BUF_SIZE);
 	if (ret)
-		return ret;
+		goto error;
 
 	mt76_dma_rx_fill(dev, &dev->q_rx);
 	mt76_dma_rx_fill(dev, &dev->mcu.q_rx);
 
+	/* MCU TX completions are reaped by the TX poll before mt76_start */
+	napi_enable(&dev->tx_napi);
+
 	return 0;
+
+error:
+	/* no buffers are queued yet, only the pool pages need to go */
+	mt76_rx_pool_cleanup(dev, &dev->q_rx);
+	mt76_rx_pool_cleanup(dev, &dev->mcu.q_rx);
+	netif_napi_del(&dev->tx_napi);
+	netif_napi_del(&dev->napi);
+	return ret;
 }
 
 void mt76_dma_cleanup(struct mt76_dev *dev)
 {
-	struct mt76_txwi_cache *t;
 	int i;
 
-	tasklet_kill(&dev->tx_tasklet);
+	napi_disable(&dev->tx_napi);
 	tasklet_kill(&dev->rx_tasklet);
 	for (i = 0; i < ARRAY_SIZE(dev->q_tx); i++)
-		mt76_tx_cleanup_queue(dev, &dev->q_tx[i], true);
+		mt76_tx_cleanup_queue(dev, &dev->q_tx[i], true,
+				      dev->q_tx[i].ndesc);
+	mt76_mac_tx_status_check(dev, true);
 	mt76_rx_cleanup(dev, &dev->q_rx);
 	mt76_rx_cleanup(dev, &dev->mcu.q_rx);
-
-	while ((t = __mt76_get_txwi(dev)) != NULL)
-		dma_unmap_single(dev->dev, t->dma_addr, sizeof(t->txwi),
-				 DMA_TO_DEVICE);
 }
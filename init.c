@@ -16,6 +16,21 @@
 #include "eeprom.h"
 #include "mcu.h"
 
+static bool rx_2b_offset;
+module_param(rx_2b_offset, bool, S_IRUGO);
+MODULE_PARM_DESC(rx_2b_offset,
+		 "Align QoS data RX payload with the DMA 2 byte offset instead of L2 padding (misaligns non-QoS payload)");
+
+static bool tx_l2_stuff;
+module_param(tx_l2_stuff, bool, S_IRUGO);
+MODULE_PARM_DESC(tx_l2_stuff,
+		 "Let the hardware insert the TX L2 pad instead of the driver");
+
+static bool rx_sta_check;
+module_param(rx_sta_check, bool, S_IRUGO);
+MODULE_PARM_DESC(rx_sta_check,
+		 "Cross-check the RX station from the WCID with an address lookup");
+
 static bool
 mt76_wait_for_mac(struct mt76_dev *dev)
 {
@@ -97,7 +112,17 @@ mt76_write_mac_initvals(struct mt76_dev *dev)
 		{ MT_PN_PAD_MODE,		0x00000002 },
 		{ MT_TXOP_HLDR_ET,		0x00000002 },
 		{ 0xa44,			0x00000000 },
+		/*
+		 * No 802.3 header translation: mac80211 only hands us frames
+		 * with the 802.11 header already built, and expects received
+		 * data frames to still carry theirs.
+		 */
 		{ MT_HEADER_TRANS_CTRL_REG,	0x00000000 },
+		/*
+		 * Hardware TSO stays off: mac80211 builds the 802.11 header
+		 * (sequence number, PN, A-MPDU state) per MPDU, so super-frames
+		 * are segmented by software GSO before they reach the driver.
+		 */
 		{ MT_TSO_CTRL,			0x00000000 },
 		{ MT_AUX_CLK_CFG,		0x00000000 },
 		{ MT_DACCLK_EN_DLY_CFG,		0x00000000 },
@@ -198,6 +223,11 @@ int mt76_mac_reset(struct mt76_dev *dev, bool hard)
 		 MT_WPDMA_GLO_CFG_DMA_BURST_SIZE);
 	val |= MT76_SET(MT_WPDMA_GLO_CFG_DMA_BURST_SIZE, 3);
 
+	if (dev->rx_2b_offset)
+		val |= MT_WPDMA_GLO_CFG_RX_2B_OFFSET;
+	else
+		val &= ~MT_WPDMA_GLO_CFG_RX_2B_OFFSET;
+
 	mt76_wr(dev, MT_WPDMA_GLO_CFG, val);
 
 	mt76_mac_pbf_init(dev);
@@ -222,6 +252,24 @@ int mt76_mac_reset(struct mt76_dev *dev, bool hard)
 	mt76_wr(dev, MT_MCU_CLOCK_CTL, 0x1401);
 	mt76_clear(dev, MT_FCE_L2_STUFF, MT_FCE_L2_STUFF_WR_MPDU_LEN_EN);
 
+	/*
+	 * With the 2 byte DMA offset, QoS data payload is already 4 byte
+	 * aligned, so the FCE does not need to insert the L2 pad on RX.
+	 * Frames with a 24 byte header (non-QoS data, management) end up
+	 * with their payload at 2 mod 4 instead, which is why the offset
+	 * stays opt-in.
+	 */
+	if (dev->rx_2b_offset)
+		mt76_clear(dev, MT_FCE_L2_STUFF, MT_FCE_L2_STUFF_RX_STUFF_EN);
+
+	mt76_set(dev, MT_FCE_CSO, MT_FCE_CSO_TX | MT_FCE_CSO_RX);
+
+	if (dev->tx_l2_stuff)
+		mt76_set(dev, MT_FCE_L2_STUFF,
+			 MT_FCE_L2_STUFF_TX_STUFF_EN |
+			 MT_FCE_L2_STUFF_QOS_L2_EN |
+			 MT_FCE_L2_STUFF_HT_L2_EN);
+
 	mt76_wr(dev, MT_MAC_ADDR_DW0, get_unaligned_le32(dev->macaddr));
 	mt76_wr(dev, MT_MAC_ADDR_DW1, get_unaligned_le16(dev->macaddr + 4));
 
@@ -271,6 +319,8 @@ int mt76_mac_start(struct mt76_dev *dev)
 		mt76_rr(dev, MT_TX_STAT_FIFO);
 
 	memset(dev->aggr_stats, 0, sizeof(dev->aggr_stats));
+	dev->aggr_len = 0;
+	mt76_mac_irq_mod_reset(dev);
 
 	mt76_wr(dev, MT_MAC_SYS_CTRL, MT_MAC_SYS_CTRL_ENABLE_TX);
 	wait_for_wpdma(dev);
@@ -510,16 +560,20 @@ int mt76_init_hardware(struct mt76_dev *dev)
 	set_bit(MT76_STATE_INITIALIZED, &dev->state);
 	ret = mt76_mac_start(dev);
 	if (ret)
-		return ret;
+		goto error;
 
 	ret = mt76_mcu_init(dev);
 	if (ret)
-		return ret;
+		goto error;
 
 	mt76_mac_stop(dev, false);
 	dev->rxfilter = mt76_rr(dev, MT_RX_FILTR_CFG);
 
 	return 0;
+
+error:
+	mt76_dma_cleanup(dev);
+	return ret;
 }
 
 void mt76_stop_hardware(struct mt76_dev *dev)
@@ -541,6 +595,7 @@ struct mt76_dev *mt76_alloc_device(struct device *pdev)
 {
 	struct ieee80211_hw *hw;
 	struct mt76_dev *dev;
+	int i;
 
 	hw = ieee80211_alloc_hw(sizeof(*dev), &mt76_ops);
 	if (!hw)
@@ -552,6 +607,17 @@ struct mt76_dev *mt76_alloc_device(struct device *pdev)
 	mutex_init(&dev->mutex);
 	spin_lock_init(&dev->lock);
 	spin_lock_init(&dev->irq_lock);
+	skb_queue_head_init(&dev->status_list);
+	dev->rx_2b_offset = rx_2b_offset;
+	dev->tx_l2_stuff = tx_l2_stuff;
+	dev->rx_sta_check = rx_sta_check;
+
+	for (i = 0; i < IEEE80211_NUM_ACS; i++) {
+		dev->aql_limit_low[i] = MT_AQL_LIMIT_LOW;
+		dev->aql_limit_high[i] = MT_AQL_LIMIT_HIGH;
+	}
+	dev->aql_threshold = MT_AQL_THRESHOLD;
+	dev->burst_airtime = MT_TX_BURST_AIRTIME;
 
 	return dev;
 }
@@ -786,7 +852,10 @@ int mt76_register_device(struct mt76_dev *dev)
 		    IEEE80211_HW_SUPPORTS_HT_CCK_RATES |
 		    IEEE80211_HW_HOST_BROADCAST_PS_BUFFERING |
 		    IEEE80211_HW_AMPDU_AGGREGATION |
+		    IEEE80211_HW_REPORTS_TX_ACK_STATUS |
 		    IEEE80211_HW_SUPPORTS_RC_TABLE;
+	hw->extra_tx_headroom = sizeof(struct mt76_txwi) + 2;
+	hw->netdev_features = NETIF_F_IP_CSUM | NETIF_F_IPV6_CSUM;
 	hw->max_rates = 1;
 	hw->max_report_rates = 7;
 	hw->max_rate_tries = 1;
@@ -832,7 +901,6 @@ int mt76_register_device(struct mt76_dev *dev)
 	if (ret)
 		goto fail;
 
-	INIT_LIST_HEAD(&dev->txwi_cache);
 	INIT_DELAYED_WORK(&dev->cal_work, mt76_phy_calibrate);
 	INIT_DELAYED_WORK(&dev->mac_work, mt76_mac_work);
 
@@ -846,6 +914,7 @@ int mt76_register_device(struct mt76_dev *dev)
 
 fail:
 	mt76_stop_hardware(dev);
+	mt76_dma_cleanup(dev);
 	return ret;
 }
 
@@ -12,7 +12,13 @@
  */
 
 #include <linux/delay.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/ip.h>
 #include "mt76.h"
+#include "dma.h"
 #include "mcu.h"
 #include "eeprom.h"
 #include "trace.h"
@@ -142,87 +148,295 @@ mt76_mac_tx_rate_val(struct mt76_dev *dev, const struct ieee80211_tx_rate *rate,
 	return cpu_to_le16(rateval);
 }
 
+/* kbit/s */
+static const u16 mt76_cck_kbps[] = { 1000, 2000, 5500, 11000 };
+static const u16 mt76_ofdm_kbps[] = {
+	6000, 9000, 12000, 18000, 24000, 36000, 48000, 54000
+};
+
+/* 100 kbit/s, one stream, 20 MHz, long GI */
+static const u16 mt76_mcs_100kbps[] = {
+	65, 130, 195, 260, 390, 520, 585, 650, 780, 867
+};
+
+/* data subcarriers per bandwidth */
+static const u8 mt76_bw_subcarriers[] = { 52, 108, 234 };
+
+/* HT/VHT PHY rate in kbit/s */
+static u32
+mt76_mac_mcs_kbps(u16 rate, int mcs, int nss)
+{
+	int bw = min_t(int, MT76_GET(MT_RXWI_RATE_BW, rate), MT_PHY_BW_80);
+	u32 kbps;
+
+	kbps = mt76_mcs_100kbps[mcs] * 100 * nss;
+	kbps = kbps * mt76_bw_subcarriers[bw] / 52;
+	if (rate & MT_RXWI_RATE_SGI)
+		kbps = kbps * 10 / 9;
+
+	return kbps;
+}
+
+/*
+ * Estimated airtime in usecs for a frame of len bytes sent at a TXWI rate.
+ * A-MPDU subframes share the preamble, so it is only charged to single
+ * frames.
+ */
+u32 mt76_mac_tx_airtime(__le16 rate_val, int len, bool ampdu)
+{
+	u16 rate = le16_to_cpu(rate_val);
+	u8 idx = MT76_GET(MT_RXWI_RATE_INDEX, rate);
+	u32 kbps, overhead;
+
+	switch (MT76_GET(MT_RXWI_RATE_PHY, rate)) {
+	case MT_PHY_TYPE_CCK:
+		kbps = mt76_cck_kbps[idx & 3];
+		overhead = (idx & 8) ? 96 : 192;
+		break;
+	case MT_PHY_TYPE_OFDM:
+		kbps = mt76_ofdm_kbps[idx & 7];
+		overhead = 20;
+		break;
+	case MT_PHY_TYPE_HT:
+	case MT_PHY_TYPE_HT_GF:
+		kbps = mt76_mac_mcs_kbps(rate, idx & 7, ((idx >> 3) & 3) + 1);
+		overhead = 36;
+		break;
+	case MT_PHY_TYPE_VHT:
+		kbps = mt76_mac_mcs_kbps(rate,
+			min_t(int, MT76_GET(MT_RATE_INDEX_VHT_IDX, idx), 9),
+			MT76_GET(MT_RATE_INDEX_VHT_NSS, idx) + 1);
+		overhead = 36;
+		break;
+	default:
+		kbps = 6000;
+		overhead = 20;
+		break;
+	}
+
+	if (ampdu)
+		overhead = 0;
+
+	return overhead + DIV_ROUND_UP(len * 8 * 1000, kbps);
+}
+
+static u8
+mt76_mac_tx_stream(struct mt76_dev *dev, __le16 rate)
+{
+	u16 rate_ht_mask = MT76_SET(MT_RXWI_RATE_PHY, BIT(1) | BIT(2));
+
+	if (mt76xx_rev(dev) >= MT76XX_REV_E4)
+		return 0x03;
+
+	if (mt76xx_rev(dev) >= MT76XX_REV_E3 &&
+	    !(rate & cpu_to_le16(rate_ht_mask)))
+		return 0x83;
+
+	return 0;
+}
+
 void mt76_mac_wcid_set_rate(struct mt76_dev *dev, struct mt76_wcid *wcid,
 			    const struct ieee80211_tx_rate *rate)
 {
 	unsigned long flags;
+	__le16 tx_rate;
+	u8 txstream;
+	u8 nss;
+
+	tx_rate = mt76_mac_tx_rate_val(dev, rate, &nss);
+	txstream = mt76_mac_tx_stream(dev, tx_rate);
 
 	spin_lock_irqsave(&dev->lock, flags);
-	wcid->tx_rate = mt76_mac_tx_rate_val(dev, rate, &wcid->tx_rate_nss);
+	write_seqcount_begin(&wcid->tx_rate_seq);
+	wcid->txwi.rate = tx_rate;
+	wcid->txwi.txstream = txstream;
+	wcid->tx_rate_nss = nss;
 	wcid->tx_rate_set = true;
+	write_seqcount_end(&wcid->tx_rate_seq);
 	spin_unlock_irqrestore(&dev->lock, flags);
 }
 
+/*
+ * Rebuild the parts of the per-station TXWI template that do not depend on
+ * the rate. The A-MPDU fields are always filled in and are stripped again
+ * for frames that are not aggregated.
+ */
+void mt76_mac_wcid_update_txwi(struct mt76_dev *dev, struct mt76_wcid *wcid,
+			       struct ieee80211_sta *sta)
+{
+	unsigned long irq_flags;
+	u16 flags = 0;
+	u8 ack_ctl = 0;
+
+	if (sta) {
+		ack_ctl = MT76_SET(MT_TXWI_ACK_CTL_BA_WINDOW,
+				   mt76_mac_ba_size(sta));
+
+		flags = MT_TXWI_FLAGS_AMPDU |
+			MT76_SET(MT_TXWI_FLAGS_MPDU_DENSITY,
+				 sta->ht_cap.ampdu_density);
+	}
+
+	spin_lock_irqsave(&dev->lock, irq_flags);
+	write_seqcount_begin(&wcid->tx_rate_seq);
+	wcid->txwi.wcid = wcid->idx;
+	wcid->txwi.flags = cpu_to_le16(flags);
+	wcid->txwi.ack_ctl = ack_ctl;
+	/* frames sent before the first rate update use the template rate */
+	if (!wcid->tx_rate_set)
+		wcid->txwi.txstream = mt76_mac_tx_stream(dev, wcid->txwi.rate);
+	write_seqcount_end(&wcid->tx_rate_seq);
+	spin_unlock_irqrestore(&dev->lock, irq_flags);
+}
+
+/* returns the number of retries caused by a concurrent template update */
+static int
+mt76_mac_wcid_get_txwi(struct mt76_wcid *wcid, struct mt76_txwi *txwi,
+		       u8 *nss)
+{
+	unsigned int seq;
+	int retries = -1;
+
+	do {
+		seq = read_seqcount_begin(&wcid->tx_rate_seq);
+		*txwi = wcid->txwi;
+		*nss = wcid->tx_rate_nss;
+		retries++;
+	} while (read_seqcount_retry(&wcid->tx_rate_seq, seq));
+
+	return retries;
+}
+
 void mt76_mac_write_txwi(struct mt76_dev *dev, struct mt76_txwi *txwi,
 			 struct sk_buff *skb, struct mt76_wcid *wcid,
-			 struct ieee80211_sta *sta)
+			 struct ieee80211_sta *sta, u8 pktid)
 {
 	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
 	struct ieee80211_tx_rate *rate = &info->control.rates[0];
-	unsigned long flags;
-	u16 rate_ht_mask = MT76_SET(MT_RXWI_RATE_PHY, BIT(1) | BIT(2));
-	u16 txwi_flags = 0;
+	struct mt76_txwi t;
 	u8 nss;
 
-	memset(txwi, 0, sizeof(*txwi));
-
-	if (wcid)
-		txwi->wcid = wcid->idx;
-	else
-		txwi->wcid = 0xff;
-
-	txwi->pktid = 1;
-
-	spin_lock_irqsave(&dev->lock, flags);
-	if (rate->idx < 0 || !rate->count) {
-		txwi->rate = wcid->tx_rate;
-		nss = wcid->tx_rate_nss;
+	if (wcid) {
+		dev->txwi_seq_retry += mt76_mac_wcid_get_txwi(wcid, &t, &nss);
 	} else {
-		txwi->rate = mt76_mac_tx_rate_val(dev, rate, &nss);
+		memset(&t, 0, sizeof(t));
+		t.wcid = 0xff;
 	}
-	spin_unlock_irqrestore(&dev->lock, flags);
 
-	if (mt76xx_rev(dev) >= MT76XX_REV_E4)
-		txwi->txstream = 0x03;
-	else if (mt76xx_rev(dev) >= MT76XX_REV_E3 &&
-		 !(txwi->rate & cpu_to_le16(rate_ht_mask)))
-		txwi->txstream = 0x83;
+	if (!wcid || (rate->idx >= 0 && rate->count)) {
+		t.rate = mt76_mac_tx_rate_val(dev, rate, &nss);
+		t.txstream = mt76_mac_tx_stream(dev, t.rate);
+	}
+
+	t.pktid = pktid;
 
 	if (info->flags & IEEE80211_TX_CTL_LDPC)
-		txwi->rate |= cpu_to_le16(MT_RXWI_RATE_LDPC);
+		t.rate |= cpu_to_le16(MT_RXWI_RATE_LDPC);
 	if ((info->flags & IEEE80211_TX_CTL_STBC) && nss == 1)
-		txwi->rate |= cpu_to_le16(MT_RXWI_RATE_STBC);
+		t.rate |= cpu_to_le16(MT_RXWI_RATE_STBC);
+
+	if (!(info->flags & IEEE80211_TX_CTL_AMPDU) || !sta) {
+		t.flags = 0;
+		t.ack_ctl = 0;
+	} else if (info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE) {
+		t.ack_ctl &= ~MT_TXWI_ACK_CTL_BA_WINDOW;
+	}
+
 	if (!(info->flags & IEEE80211_TX_CTL_NO_ACK))
-		txwi->ack_ctl |= MT_TXWI_ACK_CTL_REQ;
+		t.ack_ctl |= MT_TXWI_ACK_CTL_REQ;
 	if (info->flags & IEEE80211_TX_CTL_ASSIGN_SEQ)
-		txwi->ack_ctl |= MT_TXWI_ACK_CTL_NSEQ;
+		t.ack_ctl |= MT_TXWI_ACK_CTL_NSEQ;
 	if (info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE)
-		txwi->pktid |= MT_TXWI_PKTID_PROBE;
-	if ((info->flags & IEEE80211_TX_CTL_AMPDU) && sta) {
-		u8 ba_size = IEEE80211_MIN_AMPDU_BUF;
-		ba_size <<= sta->ht_cap.ampdu_factor;
-		ba_size = min_t(int, 63, ba_size);
-		if (info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE)
-			ba_size = 0;
-		txwi->ack_ctl |= MT76_SET(MT_TXWI_ACK_CTL_BA_WINDOW, ba_size);
+		t.pktid |= MT_TXWI_PKTID_PROBE;
+
+	t.len_ctl = cpu_to_le16(skb->len);
+
+	/* single store into the (uncached) TXWI memory */
+	*txwi = t;
+}
+
+/*
+ * The RXINFO only carries checksum error bits, so make sure the frame is
+ * one the FCE actually checks (unfragmented TCP/UDP over IPv4/IPv6 behind
+ * an LLC/SNAP header) before trusting them.
+ */
+static void
+mt76_mac_rx_csum(struct sk_buff *skb, u32 rxinfo)
+{
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *) skb->data;
+	int hdrlen;
+	u8 *data;
+	u8 l4proto;
 
-		txwi_flags |= MT_TXWI_FLAGS_AMPDU |
-			 MT76_SET(MT_TXWI_FLAGS_MPDU_DENSITY,
-				  sta->ht_cap.ampdu_density);
+	if (!(rxinfo & MT_RXINFO_DATA))
+		return;
+
+	if (rxinfo & (MT_RXINFO_TCP_SUM_ERR | MT_RXINFO_IP_SUM_ERR |
+		      MT_RXINFO_AMSDU | MT_RXINFO_FRAG))
+		return;
+
+	if (!ieee80211_is_data_present(hdr->frame_control))
+		return;
+
+	if (ieee80211_has_protected(hdr->frame_control) &&
+	    !(rxinfo & MT_RXINFO_DECRYPT))
+		return;
+
+	hdrlen = ieee80211_hdrlen(hdr->frame_control);
+	if (skb->len < hdrlen + 8 + sizeof(struct iphdr))
+		return;
+
+	data = skb->data + hdrlen;
+	if (memcmp(data, rfc1042_header, 6) &&
+	    memcmp(data, bridge_tunnel_header, 6))
+		return;
+
+	switch (get_unaligned((__be16 *) (data + 6))) {
+	case htons(ETH_P_IP): {
+		struct iphdr *ip = (struct iphdr *) (data + 8);
+
+		if (ip_is_fragment(ip))
+			return;
+
+		l4proto = ip->protocol;
+		break;
 	}
+	case htons(ETH_P_IPV6):
+		if (skb->len < hdrlen + 8 + sizeof(struct ipv6hdr))
+			return;
 
-	txwi->flags |= cpu_to_le16(txwi_flags);
-	txwi->len_ctl = cpu_to_le16(skb->len);
+		l4proto = ((struct ipv6hdr *) (data + 8))->nexthdr;
+		break;
+	default:
+		return;
+	}
+
+	if (l4proto != IPPROTO_TCP && l4proto != IPPROTO_UDP)
+		return;
+
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
 }
 
 int mt76_mac_process_rx(struct mt76_dev *dev, struct sk_buff *skb, void *rxi)
 {
 	struct ieee80211_rx_status *status = IEEE80211_SKB_RXCB(skb);
-	struct mt76_rxwi *rxwi = rxi;
-	u32 ctl = le32_to_cpu(rxwi->ctl);
-	u16 rate = le16_to_cpu(rxwi->rate);
+	struct mt76_rxwi rxwi_buf, *rxwi = rxi;
+	u32 ctl;
+	u16 rate;
 	int len;
 
+	/*
+	 * With the 2 byte DMA offset the RXWI is only 2 byte aligned. One
+	 * copy is much cheaper than an unaligned access fixup per field.
+	 */
+	if (!IS_ALIGNED((unsigned long) rxi, 4)) {
+		memcpy(&rxwi_buf, rxi, sizeof(rxwi_buf));
+		rxwi = &rxwi_buf;
+	}
+
+	ctl = le32_to_cpu(rxwi->ctl);
+	rate = le16_to_cpu(rxwi->rate);
+
 	if (rxwi->rxinfo & cpu_to_le32(MT_RXINFO_L2PAD))
 		mt76_remove_hdr_pad(skb);
 
@@ -233,6 +447,9 @@ int mt76_mac_process_rx(struct mt76_dev *dev, struct sk_buff *skb, void *rxi)
 
 	len = MT76_GET(MT_RXWI_CTL_MPDU_LEN, ctl);
 	skb_trim(skb, len);
+	mt76_mac_rx_csum(skb, le32_to_cpu(rxwi->rxinfo));
+	if (dev->rx_sta_check)
+		*mt76_skb_rx_wcid(skb) = MT76_GET(MT_RXWI_CTL_WCID, ctl);
 
 	status->chains = BIT(0) | BIT(1);
 	status->chain_signal[0] = mt76_phy_get_rssi(dev, rxwi->rssi[0], 0);
@@ -343,6 +560,206 @@ mt76_mac_fill_tx_status(struct mt76_dev *dev, struct ieee80211_tx_info *info,
 		info->flags |= IEEE80211_TX_STAT_ACK;
 }
 
+/*
+ * Frames that mac80211 wants a status for, rate control probes and QoS
+ * data that may be retried in software get a per-WCID packet id and stay
+ * on dev->status_list until both the DMA completion and the matching
+ * TX_STAT_FIFO entry have been seen. Retryable data is only tracked while
+ * fewer than MT_TX_STATUS_MAX_PENDING frames are outstanding, which also
+ * keeps a single WCID from wrapping its packet ids. All other frames are
+ * freed on DMA completion; their status only goes to rate control through
+ * ieee80211_tx_status_noskb().
+ */
+u8 mt76_mac_tx_status_add(struct mt76_dev *dev, struct mt76_wcid *wcid,
+			  struct sk_buff *skb)
+{
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *) skb->data;
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+	struct mt76_tx_info *txi = mt76_skb_tx_info(skb);
+	bool report, retryable;
+	u8 pktid;
+
+	if (!wcid)
+		return MT_PKTID_NO_STATUS;
+
+	/*
+	 * A-MPDU subframes are not retried in software: by the time their
+	 * status is seen, later subframes may have moved the receiver's BA
+	 * window and replay counter past the original SN and PN.
+	 */
+	report = info->flags & (IEEE80211_TX_CTL_REQ_TX_STATUS |
+				IEEE80211_TX_CTL_RATE_CTRL_PROBE);
+	retryable = ieee80211_is_data_qos(hdr->frame_control) &&
+		    !(info->flags & (IEEE80211_TX_CTL_RATE_CTRL_PROBE |
+				     IEEE80211_TX_CTL_AMPDU |
+				     IEEE80211_TX_CTL_NO_ACK));
+	if (!report && !retryable)
+		return MT_PKTID_NO_STATUS;
+
+	spin_lock_bh(&dev->status_list.lock);
+	if (!report &&
+	    skb_queue_len(&dev->status_list) >= MT_TX_STATUS_MAX_PENDING) {
+		spin_unlock_bh(&dev->status_list.lock);
+		return MT_PKTID_NO_STATUS;
+	}
+
+	txi->flags = retryable ? MT_TX_CB_RETRYABLE : 0;
+	pktid = (wcid->packet_id + 1) & MT_TXWI_PKTID_MASK;
+	if (pktid < MT_PKTID_FIRST)
+		pktid = MT_PKTID_FIRST;
+	wcid->packet_id = pktid;
+
+	txi->wcid = wcid->idx;
+	txi->pktid = pktid;
+	__skb_queue_tail(&dev->status_list, skb);
+	spin_unlock_bh(&dev->status_list.lock);
+
+	return pktid;
+}
+
+static void
+mt76_mac_tx_status_complete(struct mt76_dev *dev, struct sk_buff *skb)
+{
+	struct mt76_tx_info *txi = mt76_skb_tx_info(skb);
+
+	if (!(txi->flags & MT_TX_CB_RETRY)) {
+		mt76_tx_complete(dev, skb);
+		return;
+	}
+
+	if (!mt76_tx_retry(dev, skb))
+		ieee80211_free_txskb(dev->hw, skb);
+}
+
+static void
+mt76_mac_tx_status_skb(struct mt76_dev *dev, struct sk_buff *skb,
+		       struct mt76_tx_status *stat)
+{
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+
+	/*
+	 * ieee80211_tx_info_clear_status() would also wipe the driver state,
+	 * which is still needed until the frame completes.
+	 */
+	memset(&info->status, 0,
+	       offsetof(struct ieee80211_tx_info, status.status_driver_data) -
+	       offsetof(struct ieee80211_tx_info, status));
+
+	mt76_mac_fill_tx_status(dev, info, stat);
+}
+
+/*
+ * Hands a status entry to the tracked skb it belongs to. A failed frame
+ * that may still be retried in software does not take the status; it is
+ * then reported through ieee80211_tx_status_noskb() like any other entry.
+ * Returns true if the skb will report the status itself.
+ */
+static bool
+mt76_mac_tx_status_match(struct mt76_dev *dev, struct mt76_tx_status *stat)
+{
+	struct sk_buff *skb, *done = NULL;
+	u8 pktid = stat->pktid & MT_TXWI_PKTID_MASK;
+	bool ret = false;
+
+	if (pktid < MT_PKTID_FIRST)
+		return false;
+
+	spin_lock_bh(&dev->status_list.lock);
+	skb_queue_walk(&dev->status_list, skb) {
+		struct mt76_tx_info *txi = mt76_skb_tx_info(skb);
+
+		if (txi->wcid != stat->wcid || txi->pktid != pktid ||
+		    (txi->flags & MT_TX_CB_TXS_DONE))
+			continue;
+
+		txi->flags |= MT_TX_CB_TXS_DONE;
+		if (stat->success || !mt76_tx_retry_check(dev, skb)) {
+			mt76_mac_tx_status_skb(dev, skb, stat);
+			ret = true;
+		} else {
+			txi->flags |= MT_TX_CB_RETRY;
+		}
+
+		if (txi->flags & MT_TX_CB_DMA_DONE) {
+			__skb_unlink(skb, &dev->status_list);
+			done = skb;
+		}
+
+		dev->tx_status_matched++;
+		break;
+	}
+	spin_unlock_bh(&dev->status_list.lock);
+
+	if (done)
+		mt76_mac_tx_status_complete(dev, done);
+
+	return ret;
+}
+
+/*
+ * Drops tracked frames whose status did not show up in time after their
+ * DMA completion (or all of them on flush). Frames still owned by the DMA
+ * ring are left alone.
+ */
+void mt76_mac_tx_status_check(struct mt76_dev *dev, bool flush)
+{
+	struct sk_buff *skb, *tmp;
+	struct sk_buff_head list;
+
+	__skb_queue_head_init(&list);
+
+	spin_lock_bh(&dev->status_list.lock);
+	skb_queue_walk_safe(&dev->status_list, skb, tmp) {
+		struct mt76_tx_info *txi = mt76_skb_tx_info(skb);
+
+		if (!(txi->flags & MT_TX_CB_DMA_DONE))
+			continue;
+
+		if (!flush && (s32) ((u32) jiffies - txi->dma_jiffies) <=
+			      MT_TX_STATUS_TIMEOUT)
+			continue;
+
+		__skb_unlink(skb, &dev->status_list);
+		__skb_queue_tail(&list, skb);
+		dev->tx_status_expired++;
+	}
+	spin_unlock_bh(&dev->status_list.lock);
+
+	while ((skb = __skb_dequeue(&list)) != NULL)
+		ieee80211_free_txskb(dev->hw, skb);
+}
+
+/*
+ * The status FIFO does not say which AC a frame was sent from, so the
+ * retry airtime is split over the ACs the station has airtime in flight
+ * on, by their share of it. If nothing is in flight any more, it goes to
+ * the AC the station last queued a frame to.
+ */
+static void
+mt76_mac_add_airtime_debt(struct mt76_wcid *wcid, u32 airtime)
+{
+	int pending[IEEE80211_NUM_ACS];
+	int i, total = 0;
+
+	for (i = 0; i < IEEE80211_NUM_ACS; i++) {
+		pending[i] = max(atomic_read(&wcid->airtime_pending[i]), 0);
+		total += pending[i];
+	}
+
+	if (!total) {
+		atomic_add(airtime, &wcid->airtime_debt[wcid->last_ac]);
+		return;
+	}
+
+	for (i = 0; i < IEEE80211_NUM_ACS; i++) {
+		if (!pending[i])
+			continue;
+
+		atomic_add(div_u64((u64) airtime * pending[i], total),
+			   &wcid->airtime_debt[i]);
+	}
+}
+
 static void
 mt76_send_tx_status(struct mt76_dev *dev, struct mt76_tx_status *stat)
 {
@@ -359,66 +776,107 @@ mt76_send_tx_status(struct mt76_dev *dev, struct mt76_tx_status *stat)
 		msta = container_of(wcid, struct mt76_sta, wcid);
 		sta = container_of(msta, struct ieee80211_sta,
 				   drv_priv);
+
+		if (stat->retry) {
+			u32 airtime;
+
+			airtime = stat->retry *
+				  mt76_mac_tx_airtime(cpu_to_le16(stat->rate),
+						      MT_TX_AIRTIME_RETRY_LEN,
+						      stat->aggr);
+			mt76_mac_add_airtime_debt(wcid, airtime);
+			wcid->airtime_retry += airtime;
+		}
 	}
 
+	if (mt76_mac_tx_status_match(dev, stat))
+		goto out;
+
 	mt76_mac_fill_tx_status(dev, &info, stat);
 	ieee80211_tx_status_noskb(dev->hw, sta, &info);
+
+out:
 	rcu_read_unlock();
 }
 
+static bool
+mt76_mac_load_tx_status(struct mt76_dev *dev, struct mt76_tx_status *stat)
+{
+	u32 stat1, stat2;
+
+	stat1 = mt76_rr(dev, MT_TX_STAT_FIFO);
+	if (!(stat1 & MT_TX_STAT_FIFO_VALID))
+		return false;
+
+	stat2 = mt76_rr(dev, MT_TX_STAT_FIFO_EXT);
+
+	stat->valid = 1;
+	stat->success = !!(stat1 & MT_TX_STAT_FIFO_SUCCESS);
+	stat->aggr = !!(stat1 & MT_TX_STAT_FIFO_AGGR);
+	stat->ack_req = !!(stat1 & MT_TX_STAT_FIFO_ACKREQ);
+	stat->wcid = MT76_GET(MT_TX_STAT_FIFO_WCID, stat1);
+	stat->rate = MT76_GET(MT_TX_STAT_FIFO_RATE, stat1);
+	stat->retry = MT76_GET(MT_TX_STAT_FIFO_EXT_RETRY, stat2);
+	stat->pktid = MT76_GET(MT_TX_STAT_FIFO_EXT_PKTID, stat2);
+	trace_mac_txstat_fetch(dev, stat);
+
+	return true;
+}
+
+/*
+ * From the interrupt handler, entries are only buffered in the kfifo.
+ * Otherwise they are processed right away, with irq_lock dropped, since
+ * matching an entry may complete or requeue the skb it belongs to.
+ */
 void mt76_mac_poll_tx_status(struct mt76_dev *dev, bool irq)
 {
 	struct mt76_tx_status stat = {};
 	unsigned long flags;
+	bool valid;
 
 	if (!test_bit(MT76_STATE_RUNNING, &dev->state))
 		return;
 
 	trace_mac_txstat_poll(dev);
 
-	spin_lock_irqsave(&dev->irq_lock, flags);
 	while (!irq || !kfifo_is_full(&dev->txstatus_fifo)) {
-		u32 stat1, stat2;
+		spin_lock_irqsave(&dev->irq_lock, flags);
+		valid = mt76_mac_load_tx_status(dev, &stat);
+		if (valid && irq)
+			kfifo_put(&dev->txstatus_fifo, stat);
+		spin_unlock_irqrestore(&dev->irq_lock, flags);
 
-		stat1 = mt76_rr(dev, MT_TX_STAT_FIFO);
-		if (!(stat1 & MT_TX_STAT_FIFO_VALID))
+		if (!valid)
 			break;
 
-		stat2 = mt76_rr(dev, MT_TX_STAT_FIFO_EXT);
-
-		stat.valid = 1;
-		stat.success = !!(stat1 & MT_TX_STAT_FIFO_SUCCESS);
-		stat.aggr = !!(stat1 & MT_TX_STAT_FIFO_AGGR);
-		stat.ack_req = !!(stat1 & MT_TX_STAT_FIFO_ACKREQ);
-		stat.wcid = MT76_GET(MT_TX_STAT_FIFO_WCID, stat1);
-		stat.rate = MT76_GET(MT_TX_STAT_FIFO_RATE, stat1);
-		stat.retry = MT76_GET(MT_TX_STAT_FIFO_EXT_RETRY, stat2);
-		stat.pktid = MT76_GET(MT_TX_STAT_FIFO_EXT_PKTID, stat2);
-		trace_mac_txstat_fetch(dev, &stat);
-
-		if (!irq) {
+		if (!irq)
 			mt76_send_tx_status(dev, &stat);
-			continue;
-		}
-
-		kfifo_put(&dev->txstatus_fifo, stat);
 	}
-	spin_unlock_irqrestore(&dev->irq_lock, flags);
 }
 
 void mt76_mac_queue_txdone(struct mt76_dev *dev, struct sk_buff *skb,
-			   struct mt76_txwi *txwi)
+			   u8 wcid, u8 pktid)
 {
 	struct mt76_tx_info *txi = mt76_skb_tx_info(skb);
+	bool done;
+
+	trace_mac_txdone_add(dev, wcid, pktid);
+
+	if ((pktid & MT_TXWI_PKTID_MASK) < MT_PKTID_FIRST) {
+		ieee80211_free_txskb(dev->hw, skb);
+		return;
+	}
 
-	mt76_mac_poll_tx_status(dev, false);
+	spin_lock_bh(&dev->status_list.lock);
+	txi->flags |= MT_TX_CB_DMA_DONE;
+	txi->dma_jiffies = jiffies;
+	done = txi->flags & MT_TX_CB_TXS_DONE;
+	if (done)
+		__skb_unlink(skb, &dev->status_list);
+	spin_unlock_bh(&dev->status_list.lock);
 
-	txi->tries = 0;
-	txi->jiffies = jiffies;
-	txi->wcid = txwi->wcid;
-	txi->pktid = txwi->pktid;
-	trace_mac_txdone_add(dev, txwi->wcid, txwi->pktid);
-	mt76_tx_complete(dev, skb);
+	if (done)
+		mt76_mac_tx_status_complete(dev, skb);
 }
 
 void mt76_mac_process_tx_status_fifo(struct mt76_dev *dev)
@@ -540,6 +998,46 @@ int mt76_mac_skb_tx_overhead(struct mt76_dev *dev, struct sk_buff *skb)
 	return overhead;
 }
 
+/*
+ * Returns the TXD checksum offload bits for a CHECKSUM_PARTIAL frame, or 0
+ * if the hardware cannot handle its layout and the caller has to fall back
+ * to skb_checksum_help().
+ */
+u32 mt76_mac_tx_csum_info(struct sk_buff *skb)
+{
+	u32 info = MT_TXD_INFO_CSO;
+	u8 l4proto;
+
+	switch (skb->protocol) {
+	case htons(ETH_P_IP):
+		l4proto = ip_hdr(skb)->protocol;
+		info |= MT_TXD_INFO_ICO;
+		break;
+	case htons(ETH_P_IPV6):
+		l4proto = ipv6_hdr(skb)->nexthdr;
+		break;
+	default:
+		return 0;
+	}
+
+	switch (l4proto) {
+	case IPPROTO_TCP:
+		if (skb->csum_offset != offsetof(struct tcphdr, check))
+			return 0;
+		info |= MT_TXD_INFO_TCO;
+		break;
+	case IPPROTO_UDP:
+		if (skb->csum_offset != offsetof(struct udphdr, check))
+			return 0;
+		info |= MT_TXD_INFO_UCO;
+		break;
+	default:
+		return 0;
+	}
+
+	return info;
+}
+
 static int
 mt76_write_beacon(struct mt76_dev *dev, int offset, struct sk_buff *skb)
 {
@@ -549,7 +1047,7 @@ mt76_write_beacon(struct mt76_dev *dev, int offset, struct sk_buff *skb)
 	if (WARN_ON_ONCE(beacon_len < skb->len + sizeof(struct mt76_txwi)))
 		return -ENOSPC;
 
-	mt76_mac_write_txwi(dev, &txwi, skb, NULL, NULL);
+	mt76_mac_write_txwi(dev, &txwi, skb, NULL, NULL, MT_PKTID_NO_STATUS);
 	txwi.flags |= cpu_to_le16(MT_TXWI_FLAGS_TS);
 
 	mt76_wr_copy(dev, offset, &txwi, sizeof(txwi));
@@ -648,16 +1146,151 @@ void mt76_mac_set_beacon_enable(struct mt76_dev *dev, u8 vif_idx, bool val)
 		mt76_irq_disable(dev, MT_INT_PRE_TBTT | MT_INT_TBTT);
 }
 
+/* delay interrupt profiles: max pending frames, max pending time */
+static const struct {
+	u8 pint;
+	u8 ptime;
+} mt76_irq_profiles[] = {
+	{ 0, 0 },
+	{ 2, 2 },
+	{ 4, 4 },
+	{ 8, 8 },
+	{ 16, 12 },
+	{ 32, 16 },
+};
+
+#define MT_IRQ_MOD_MIN_FRAME_RATE	1000
+#define MT_IRQ_MOD_HIGH_IRQ_RATE	8000
+#define MT_IRQ_MOD_LOW_IRQ_RATE		2000
+
+static void
+mt76_mac_irq_mod_set(struct mt76_irq_mod *mod, int profile)
+{
+	profile = clamp_t(int, profile, 0, ARRAY_SIZE(mt76_irq_profiles) - 1);
+	mod->profile = profile;
+	mod->pint = mt76_irq_profiles[profile].pint;
+	mod->ptime = mt76_irq_profiles[profile].ptime;
+}
+
+/*
+ * Pick the next profile from the last interval: no moderation at low frame
+ * rates, back off when NAPI keeps exhausting its budget (interrupts are
+ * already rare then and the delay only adds latency), otherwise keep the
+ * interrupt rate between the low and high watermarks.
+ */
+static void
+mt76_mac_irq_mod_update(struct mt76_irq_mod *mod)
+{
+	u32 irqs = mod->irqs - mod->last_irqs;
+	u32 frames = mod->frames - mod->last_frames;
+	u32 polls = mod->polls - mod->last_polls;
+	u32 full_polls = mod->full_polls - mod->last_full_polls;
+	int profile = mod->profile;
+
+	mod->last_irqs += irqs;
+	mod->last_frames += frames;
+	mod->last_polls += polls;
+	mod->last_full_polls += full_polls;
+
+	mod->irq_rate = irqs * HZ / MT_CALIBRATE_INTERVAL;
+	mod->frame_rate = frames * HZ / MT_CALIBRATE_INTERVAL;
+
+	if (mod->frame_rate < MT_IRQ_MOD_MIN_FRAME_RATE)
+		profile = 0;
+	else if (full_polls * 4 > polls)
+		profile--;
+	else if (mod->irq_rate > MT_IRQ_MOD_HIGH_IRQ_RATE)
+		profile++;
+	else if (mod->irq_rate < MT_IRQ_MOD_LOW_IRQ_RATE)
+		profile--;
+
+	mt76_mac_irq_mod_set(mod, profile);
+}
+
+static void
+mt76_mac_irq_mod_apply(struct mt76_dev *dev)
+{
+	struct mt76_irq_mod *rx = &dev->rx_mod, *tx = &dev->tx_mod;
+	u32 val = 0;
+
+	if (rx->profile)
+		val |= MT76_SET(MT_WPDMA_DELAY_INT_CFG_RX_MAX_PTIME, rx->ptime) |
+		       MT76_SET(MT_WPDMA_DELAY_INT_CFG_RX_MAX_PINT, rx->pint) |
+		       MT_WPDMA_DELAY_INT_CFG_RX_DLY_EN;
+
+	if (tx->profile)
+		val |= MT76_SET(MT_WPDMA_DELAY_INT_CFG_TX_MAX_PTIME, tx->ptime) |
+		       MT76_SET(MT_WPDMA_DELAY_INT_CFG_TX_MAX_PINT, tx->pint) |
+		       MT_WPDMA_DELAY_INT_CFG_TX_DLY_EN;
+
+	mt76_wr(dev, MT_WPDMA_DELAY_INT_CFG, val);
+
+	mt76_irq_set_mod_mask(dev, rx, rx->profile ? MT_INT_RXDELAYINT :
+						     MT_INT_RX_DONE(0));
+	mt76_irq_set_mod_mask(dev, tx, tx->profile ? MT_INT_TXDELAYINT :
+						     MT_INT_TX_DONE_ALL);
+}
+
+static void
+mt76_mac_irq_mod_restart(struct mt76_irq_mod *mod)
+{
+	mod->last_irqs = mod->irqs;
+	mod->last_frames = mod->frames;
+	mod->last_polls = mod->polls;
+	mod->last_full_polls = mod->full_polls;
+	mod->irq_rate = 0;
+	mod->frame_rate = 0;
+	mt76_mac_irq_mod_set(mod, 0);
+}
+
+/*
+ * TX NAPI may already be running here (it reaps MCU completions), so the
+ * counters are only snapshotted and the mask is switched back to the done
+ * interrupts under irq_lock, like on any other profile change.
+ */
+void mt76_mac_irq_mod_reset(struct mt76_dev *dev)
+{
+	mt76_mac_irq_mod_restart(&dev->rx_mod);
+	mt76_mac_irq_mod_restart(&dev->tx_mod);
+	mt76_mac_irq_mod_apply(dev);
+}
+
 void mt76_mac_work(struct work_struct *work)
 {
 	struct mt76_dev *dev = container_of(work, struct mt76_dev,
 					    mac_work.work);
+	int rx_profile = dev->rx_mod.profile;
+	int tx_profile = dev->tx_mod.profile;
+	u32 n_ampdu = 0, n_mpdu = 0;
 	int i, idx;
 
 	for (i = 0, idx = 0; i < 16; i++) {
 		u32 val = mt76_rr(dev, MT_TX_AGG_CNT(i));
-		dev->aggr_stats[idx++] += val & 0xffff;
-		dev->aggr_stats[idx++] += val >> 16;
+		u32 lo = val & 0xffff, hi = val >> 16;
+
+		dev->aggr_stats[idx++] += lo;
+		dev->aggr_stats[idx++] += hi;
+
+		/* counter idx counts A-MPDUs of idx + 1 subframes */
+		n_ampdu += lo + hi;
+		n_mpdu += lo * (idx - 1) + hi * idx;
+	}
+
+	if (n_ampdu)
+		dev->aggr_len = DIV_ROUND_CLOSEST(n_mpdu, n_ampdu);
+
+	mt76_mac_irq_mod_update(&dev->rx_mod);
+	mt76_mac_irq_mod_update(&dev->tx_mod);
+	if (dev->rx_mod.profile != rx_profile ||
+	    dev->tx_mod.profile != tx_profile)
+		mt76_mac_irq_mod_apply(dev);
+
+	/* expire stale tx status entries even if the link went idle */
+	if (!skb_queue_empty(&dev->status_list)) {
+		mt76_irq_disable(dev, MT_INT_TX_DONE_ALL | MT_INT_TXDELAYINT);
+		local_bh_disable();
+		napi_schedule(&dev->tx_napi);
+		local_bh_enable();
 	}
 
 	ieee80211_queue_delayed_work(dev->hw, &dev->mac_work,
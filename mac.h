@@ -21,7 +21,6 @@ struct mt76_wcid;
 
 struct mt76_txwi;
 struct mt76_queue;
-struct mt76_txwi_cache;
 
 struct mt76_tx_status {
 	u8 valid:1;
@@ -35,14 +34,23 @@ struct mt76_tx_status {
 } __packed __aligned(2);
 
 struct mt76_tx_info {
-	unsigned long jiffies;
-	u8 tries;
+	u32 jiffies;
+	u32 dma_jiffies;
+	u8 flags;
 
 	u8 wcid;
 	u8 pktid;
 	u8 retry;
+
+	/* crypto overhead, control.hw_key is gone once this is set up */
+	u8 overhead;
 };
 
+#define MT_TX_CB_DMA_DONE		BIT(0)
+#define MT_TX_CB_TXS_DONE		BIT(1)
+#define MT_TX_CB_RETRY			BIT(2)
+#define MT_TX_CB_RETRYABLE		BIT(3)
+
 struct mt76_rxwi {
 	__le32 rxinfo;
 
@@ -139,6 +147,10 @@ enum mt76_phy_bandwith {
 #define MT_TXWI_ACK_CTL_BA_WINDOW	GENMASK(7, 2)
 
 #define MT_TXWI_PKTID_PROBE		BIT(7)
+#define MT_TXWI_PKTID_MASK		GENMASK(6, 0)
+
+#define MT_PKTID_NO_STATUS		1
+#define MT_PKTID_FIRST			2
 
 struct mt76_txwi {
 	__le16 flags;
@@ -155,13 +167,37 @@ struct mt76_txwi {
 } __packed __aligned(4);
 
 
+/*
+ * Kept in status.status_driver_data from the time the driver takes the
+ * frame. This overlaps control.hw_key, so everything the TX path needs
+ * from it has to be copied in first.
+ */
 static inline struct mt76_tx_info *
 mt76_skb_tx_info(struct sk_buff *skb)
 {
 	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+
+	BUILD_BUG_ON(sizeof(struct mt76_tx_info) >
+		     sizeof(info->status.status_driver_data));
 	return (void *) info->status.status_driver_data;
 }
 
+static inline int
+mt76_mac_ba_size(struct ieee80211_sta *sta)
+{
+	return min_t(int, 63, IEEE80211_MIN_AMPDU_BUF <<
+			      sta->ht_cap.ampdu_factor);
+}
+
+/* RXWI WCID index behind the rx status, only filled in for rx_sta_check */
+static inline u8 *
+mt76_skb_rx_wcid(struct sk_buff *skb)
+{
+	BUILD_BUG_ON(sizeof(struct ieee80211_rx_status) >=
+		     sizeof(skb->cb));
+	return (u8 *) &skb->cb[sizeof(skb->cb) - 1];
+}
+
 int mt76_mac_reset(struct mt76_dev *dev, bool hard);
 int mt76_mac_start(struct mt76_dev *dev);
 void mt76_mac_stop(struct mt76_dev *dev, bool force);
@@ -171,12 +207,14 @@ void mt76_mac_set_bssid(struct mt76_dev *dev, u8 idx, const u8 *addr);
 int mt76_mac_process_rx(struct mt76_dev *dev, struct sk_buff *skb, void *rxwi);
 void mt76_mac_write_txwi(struct mt76_dev *dev, struct mt76_txwi *txwi,
 			 struct sk_buff *skb, struct mt76_wcid *wcid,
-			 struct ieee80211_sta *sta);
+			 struct ieee80211_sta *sta, u8 pktid);
 void mt76_mac_wcid_setup(struct mt76_dev *dev, u8 idx, u8 vif_idx, u8 *mac);
 int mt76_mac_wcid_set_key(struct mt76_dev *dev, u8 idx,
 			  struct ieee80211_key_conf *key);
 void mt76_mac_wcid_set_rate(struct mt76_dev *dev, struct mt76_wcid *wcid,
 			    const struct ieee80211_tx_rate *rate);
+void mt76_mac_wcid_update_txwi(struct mt76_dev *dev, struct mt76_wcid *wcid,
+			       struct ieee80211_sta *sta);
 
 int mt76_mac_shared_key_setup(struct mt76_dev *dev, u8 vif_idx, u8 key_idx,
 			      struct ieee80211_key_conf *key);
@@ -184,14 +222,20 @@ int mt76_mac_shared_key_setup(struct mt76_dev *dev, u8 vif_idx, u8 key_idx,
 int mt76_insert_hdr_pad(struct sk_buff *skb);
 void mt76_remove_hdr_pad(struct sk_buff *skb);
 int mt76_mac_skb_tx_overhead(struct mt76_dev *dev, struct sk_buff *skb);
+u32 mt76_mac_tx_csum_info(struct sk_buff *skb);
+u32 mt76_mac_tx_airtime(__le16 rate_val, int len, bool ampdu);
 
 int mt76_mac_set_beacon(struct mt76_dev *dev, u8 vif_idx, struct sk_buff *skb);
 void mt76_mac_set_beacon_enable(struct mt76_dev *dev, u8 vif_idx, bool val);
 
+u8 mt76_mac_tx_status_add(struct mt76_dev *dev, struct mt76_wcid *wcid,
+			  struct sk_buff *skb);
+void mt76_mac_tx_status_check(struct mt76_dev *dev, bool flush);
 void mt76_mac_queue_txdone(struct mt76_dev *dev, struct sk_buff *skb,
-			   struct mt76_txwi *txwi);
+			   u8 wcid, u8 pktid);
 
 void mt76_mac_poll_tx_status(struct mt76_dev *dev, bool irq);
+void mt76_mac_irq_mod_reset(struct mt76_dev *dev);
 void mt76_mac_process_tx_status_fifo(struct mt76_dev *dev);
 
 void mt76_mac_work(struct work_struct *work);
@@ -58,6 +58,7 @@ mt76_add_interface(struct ieee80211_hw *hw, struct ieee80211_vif *vif)
 	struct mt76_dev *dev = hw->priv;
 	struct mt76_vif *mvif = (struct mt76_vif *) vif->drv_priv;
 	unsigned int idx = 0;
+	int i;
 	int ret = 0;
 
 	if (vif->addr[0] & BIT(1))
@@ -82,6 +83,10 @@ mt76_add_interface(struct ieee80211_hw *hw, struct ieee80211_vif *vif)
 	mvif->idx = idx;
 	mvif->group_wcid.idx = 254 - idx;
 	mvif->group_wcid.hw_key_idx = -1;
+	seqcount_init(&mvif->group_wcid.tx_rate_seq);
+	for (i = 0; i < IEEE80211_NUM_ACS; i++)
+		atomic_set(&mvif->group_wcid.airtime_debt[i], 0);
+	mt76_mac_wcid_update_txwi(dev, &mvif->group_wcid, NULL);
 	mt76_txq_init(dev, vif->txq);
 
 	return ret;
@@ -230,7 +235,14 @@ mt76_sta_add(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 	}
 
 	msta->wcid.idx = idx;
+	msta->wcid.gen = ++dev->wcid_gen;
 	msta->wcid.hw_key_idx = -1;
+	seqcount_init(&msta->wcid.tx_rate_seq);
+	for (i = 0; i < IEEE80211_NUM_ACS; i++) {
+		atomic_set(&msta->wcid.airtime_debt[i], 0);
+		atomic_set(&msta->wcid.airtime_pending[i], 0);
+	}
+	mt76_mac_wcid_update_txwi(dev, &msta->wcid, sta);
 	mt76_mac_wcid_setup(dev, idx, mvif->idx, sta->addr);
 	mt76_clear(dev, MT_WCID_DROP(idx), MT_WCID_DROP_MASK(idx));
 	for (i = 0; i < ARRAY_SIZE(sta->txq); i++)
@@ -397,6 +409,7 @@ mt76_ampdu_action(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 		mt76_clear(dev, MT_WCID_ADDR(msta->wcid.idx)+4, BIT(16 + tid));
 		break;
 	case IEEE80211_AMPDU_TX_OPERATIONAL:
+		mt76_mac_wcid_update_txwi(dev, &msta->wcid, sta);
 		ieee80211_send_bar(vif, sta->addr, tid, msta->agg_ssn[tid]);
 		break;
 	case IEEE80211_AMPDU_TX_STOP_FLUSH:
@@ -452,15 +465,75 @@ const struct ieee80211_ops mt76_ops = {
 	.get_txpower = mt76_get_txpower,
 	.wake_tx_queue = mt76_wake_tx_queue,
 	.sta_rate_tbl_update = mt76_sta_rate_tbl_update,
+#ifdef CONFIG_MAC80211_DEBUGFS
+	.sta_add_debugfs = mt76_sta_add_debugfs,
+#endif
 };
 
-void mt76_rx(struct mt76_dev *dev, struct sk_buff *skb)
+static struct ieee80211_sta *
+mt76_rx_get_sta(struct mt76_dev *dev, u8 idx)
 {
+	struct mt76_wcid *wcid;
+	void *msta;
+
+	if (idx >= ARRAY_SIZE(dev->wcid))
+		return NULL;
+
+	wcid = rcu_dereference(dev->wcid[idx]);
+	if (!wcid)
+		return NULL;
+
+	msta = container_of(wcid, struct mt76_sta, wcid);
+	return container_of(msta, struct ieee80211_sta, drv_priv);
+}
+
+static void
+mt76_rx_check_sta(struct mt76_dev *dev, struct sk_buff *skb,
+		  struct ieee80211_sta *sta)
+{
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *) skb->data;
+	struct ieee80211_sta *ref;
+
+	if (skb->len < 16)
+		return;
+
+	ref = ieee80211_find_sta_by_ifaddr(dev->hw, hdr->addr2, NULL);
+	dev->rx_sta_checked++;
+	if (ref != sta)
+		dev->rx_sta_mismatch++;
+}
+
+/*
+ * Frames of one poll are collected while the ring is processed and handed
+ * over once it has been refilled. mac80211 has no list receive entry
+ * point, so they still go up one at a time.
+ */
+void mt76_rx_complete(struct mt76_dev *dev, struct sk_buff_head *frames)
+{
+	struct ieee80211_sta *sta;
+	struct sk_buff *skb;
+
+	if (skb_queue_empty(frames))
+		return;
+
 	if (!test_bit(MT76_STATE_RUNNING, &dev->state)) {
-		dev_kfree_skb(skb);
+		__skb_queue_purge(frames);
 		return;
 	}
 
-	ieee80211_rx(dev->hw, skb);
+	/*
+	 * ieee80211_rx() looks the station up on its own; the WCID based
+	 * lookup is only used to cross-check it when rx_sta_check is set.
+	 */
+	rcu_read_lock();
+	while ((skb = __skb_dequeue(frames)) != NULL) {
+		if (dev->rx_sta_check) {
+			sta = mt76_rx_get_sta(dev, *mt76_skb_rx_wcid(skb));
+			mt76_rx_check_sta(dev, skb, sta);
+		}
+
+		ieee80211_rx(dev->hw, skb);
+	}
+	rcu_read_unlock();
 }
 
@@ -19,6 +19,7 @@
 #include <linux/io.h>
 #include <linux/dma-mapping.h>
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
 #include <linux/irq.h>
@@ -26,6 +27,7 @@
 #include <linux/mutex.h>
 #include <linux/bitops.h>
 #include <linux/kfifo.h>
+#include <linux/dynamic_queue_limits.h>
 #include <net/mac80211.h>
 
 #define MT7662_FIRMWARE		"mt7662.bin"
@@ -37,6 +39,22 @@
 #define MT_RX_RING_SIZE		128
 
 #define MT_TX_RING_SIZE		128
+#define MT_TX_KICK_BATCH	32
+#define MT_TXQ_AIRTIME_QUANTUM	1000
+#define MT_TX_AIRTIME_RETRY_LEN	1500
+
+#define MT_AQL_LIMIT_LOW	5000
+#define MT_AQL_LIMIT_HIGH	12000
+#define MT_AQL_THRESHOLD	24000
+
+#define MT_TX_BURST_AIRTIME	4000
+#define MT_TX_BURST_MPDU_LEN	1500
+#define MT_TX_BURST_LEGACY_MAX	3
+
+#define MT_TX_SW_RETRY_MAX	2
+#define MT_TX_SW_RETRY_TIMEOUT	(HZ / 10)
+#define MT_TX_STATUS_TIMEOUT	(HZ / 4)
+#define MT_TX_STATUS_MAX_PENDING	64
 
 #define MT_MCU_RING_SIZE	32
 
@@ -48,13 +66,40 @@
 #include "util.h"
 #include "mac.h"
 
+struct mt76_rx_page {
+	struct page *page;
+	dma_addr_t dma_addr;
+	bool used;
+};
+
+struct mt76_rx_pool {
+	struct mt76_rx_page *pages;
+	int n_pages;
+	int cur;
+	unsigned int offset;
+
+	/* buffers carved from pool pages / allocated outside the pool */
+	u32 allocs;
+	u32 fallback;
+	/* pool pages taken again after all their buffers came back */
+	u32 recycled;
+};
+
 struct mt76_queue_entry {
 	struct sk_buff *skb;
 	union {
 		void *buf;
-		struct mt76_txwi_cache *txwi;
+		struct mt76_txwi *txwi;
 	};
+	struct mt76_rx_page *rx_page;
+	dma_addr_t dma_addr;
+	u32 wcid_gen;
+	u16 bytes;
+	u16 airtime;
+	u8 wcid;
+	u8 pktid;
 	bool schedule;
+	bool txwi_inline;
 };
 
 enum {
@@ -83,6 +128,23 @@ struct mt76_queue {
 	struct list_head swq;
 	int swq_queued;
 
+	/* byte limit for frames in flight on data rings */
+	struct dql dql;
+
+	struct mt76_txwi *txwi;
+	dma_addr_t txwi_dma;
+	u32 txwi_inline;
+	u32 txwi_fallback;
+	u32 csum_offload;
+	u32 csum_fallback;
+	u32 dma_idx_invalid;
+	u32 lock_contended;
+
+	/* descriptors posted since the last cpu_idx write */
+	u16 kick_pending;
+	u32 doorbells;
+	u32 doorbell_frames;
+
 	u16 head;
 	u16 tail;
 	int ndesc;
@@ -90,6 +152,8 @@ struct mt76_queue {
 	int buf_size;
 
 	dma_addr_t desc_dma;
+
+	struct mt76_rx_pool pool;
 };
 
 struct mt76_mcu {
@@ -131,9 +195,24 @@ struct mt76_wcid {
 	u8 idx;
 	u8 hw_key_idx;
 
-	__le16 tx_rate;
+	/* TXWI template, rebuilt on rate table and A-MPDU changes */
+	seqcount_t tx_rate_seq;
+	struct mt76_txwi txwi;
 	bool tx_rate_set;
 	u8 tx_rate_nss;
+
+	/* retry airtime reported by the status FIFO, not yet charged, per AC */
+	atomic_t airtime_debt[IEEE80211_NUM_ACS];
+	u32 airtime_retry;
+
+	/* estimated airtime queued to the hardware, per AC */
+	atomic_t airtime_pending[IEEE80211_NUM_ACS];
+	u8 last_ac;
+	/* tells ring entries of an earlier owner of this index apart */
+	u32 gen;
+
+	/* last TXWI packet id handed out, protected by dev->status_list.lock */
+	u8 packet_id;
 };
 
 struct mt76_hw_cap {
@@ -141,6 +220,27 @@ struct mt76_hw_cap {
 	bool has_5ghz;
 };
 
+struct mt76_irq_mod {
+	/* updated from the irq handler and NAPI poll */
+	u32 irqs;
+	u32 frames;
+	u32 polls;
+	u32 full_polls;
+
+	/* snapshot taken by mt76_mac_work */
+	u32 last_irqs;
+	u32 last_frames;
+	u32 last_polls;
+	u32 last_full_polls;
+	u32 irq_rate;
+	u32 frame_rate;
+
+	u32 mask;
+	int profile;
+	u8 pint;
+	u8 ptime;
+};
+
 struct mt76_dev {
 	struct ieee80211_hw *hw;
 	struct device *dev;
@@ -153,6 +253,7 @@ struct mt76_dev {
 
 	const u16 *beacon_offsets;
 	unsigned long wcid_mask[256 / BITS_PER_LONG];
+	u32 wcid_gen;
 
 	struct cfg80211_chan_def chandef;
 	struct ieee80211_supported_band sband_2g;
@@ -162,28 +263,32 @@ struct mt76_dev {
 
 	u8 txdone_seq;
 	DECLARE_KFIFO_PTR(txstatus_fifo, struct mt76_tx_status);
+	struct sk_buff_head status_list;
 
-	struct list_head txwi_cache;
 	struct mt76_mcu mcu;
 	struct mt76_queue q_rx;
 	struct mt76_queue q_tx[__MT_TXQ_MAX];
 
 	struct net_device napi_dev;
 	struct napi_struct napi;
+	struct napi_struct tx_napi;
 
-	struct tasklet_struct tx_tasklet;
 	struct tasklet_struct rx_tasklet;
 	struct tasklet_struct pre_tbtt_tasklet;
 	struct delayed_work cal_work;
 	struct delayed_work mac_work;
 
 	u32 aggr_stats[32];
+	u32 aggr_len;
+	u32 burst_airtime;
 
 	struct mt76_wcid __rcu *wcid[254 - 8];
 
 	spinlock_t lock;
 	spinlock_t irq_lock;
 	u32 irqmask;
+	struct mt76_irq_mod rx_mod;
+	struct mt76_irq_mod tx_mod;
 	unsigned long state;
 
 	struct sk_buff *beacons[8];
@@ -194,12 +299,32 @@ struct mt76_dev {
 	u32 rxfilter;
 
 	u16 chainmask;
+	bool rx_2b_offset;
+	bool tx_l2_stuff;
+	bool rx_sta_check;
 
 	struct mt76_calibration cal;
 	struct debugfs_blob_wrapper eeprom;
 	struct mt76_hw_cap cap;
 
 	u32 debugfs_reg;
+
+	u32 rx_sta_checked;
+	u32 rx_sta_mismatch;
+	u32 txwi_seq_retry;
+
+	atomic_t aql_pending[IEEE80211_NUM_ACS];
+	u32 aql_limit_low[IEEE80211_NUM_ACS];
+	u32 aql_limit_high[IEEE80211_NUM_ACS];
+	u32 aql_threshold;
+	u32 aql_throttled[IEEE80211_NUM_ACS];
+
+	u32 tx_retry_requeued;
+	u32 tx_retry_expired;
+	u32 tx_retry_recovered;
+
+	u32 tx_status_matched;
+	u32 tx_status_expired;
 };
 
 struct mt76_vif {
@@ -217,6 +342,9 @@ struct mt76_txq {
 	struct list_head list;
 	struct mt76_queue *hwq;
 
+	int deficit;
+	u64 airtime;
+
 	struct sk_buff_head retry_q;
 };
 
@@ -264,6 +392,9 @@ static inline u16 mt76xx_rev(struct mt76_dev *dev)
 }
 
 void mt76_set_irq_mask(struct mt76_dev *dev, u32 clear, u32 set);
+void mt76_irq_enable_mod(struct mt76_dev *dev, struct mt76_irq_mod *mod);
+void mt76_irq_set_mod_mask(struct mt76_dev *dev, struct mt76_irq_mod *mod,
+			   u32 mask);
 
 static inline void mt76_irq_enable(struct mt76_dev *dev, u32 mask)
 {
@@ -275,6 +406,21 @@ static inline void mt76_irq_disable(struct mt76_dev *dev, u32 mask)
 	mt76_set_irq_mask(dev, mask, 0);
 }
 
+/* TX hot path lock, counts how often another CPU was holding it */
+static inline void mt76_queue_lock(struct mt76_queue *q)
+{
+	if (spin_trylock_bh(&q->lock))
+		return;
+
+	spin_lock_bh(&q->lock);
+	q->lock_contended++;
+}
+
+static inline void mt76_queue_unlock(struct mt76_queue *q)
+{
+	spin_unlock_bh(&q->lock);
+}
+
 static inline struct ieee80211_txq *
 mtxq_to_txq(struct mt76_txq *mtxq)
 {
@@ -287,6 +433,8 @@ extern const struct ieee80211_ops mt76_ops;
 struct mt76_dev *mt76_alloc_device(struct device *pdev);
 int mt76_register_device(struct mt76_dev *dev);
 void mt76_init_debugfs(struct mt76_dev *dev);
+void mt76_sta_add_debugfs(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
+			  struct ieee80211_sta *sta, struct dentry *dir);
 
 irqreturn_t mt76_irq_handler(int irq, void *dev_instance);
 void mt76_phy_power_on(struct mt76_dev *dev);
@@ -314,7 +462,7 @@ int mt76_dma_init(struct mt76_dev *dev);
 void mt76_dma_cleanup(struct mt76_dev *dev);
 
 void mt76_cleanup(struct mt76_dev *dev);
-void mt76_rx(struct mt76_dev *dev, struct sk_buff *skb);
+void mt76_rx_complete(struct mt76_dev *dev, struct sk_buff_head *frames);
 
 int __mt76_tx_queue_skb(struct mt76_dev *dev, enum mt76_txq_id qid,
 			struct sk_buff *skb, u32 tx_info);
@@ -326,7 +474,10 @@ int mt76_tx_queue_skb(struct mt76_dev *dev, struct mt76_queue *q,
 void mt76_tx(struct ieee80211_hw *hw, struct ieee80211_tx_control *control,
 	     struct sk_buff *skb);
 void mt76_tx_complete(struct mt76_dev *dev, struct sk_buff *skb);
+bool mt76_tx_retry_check(struct mt76_dev *dev, struct sk_buff *skb);
+bool mt76_tx_retry(struct mt76_dev *dev, struct sk_buff *skb);
 
+void __mt76_kick_queue(struct mt76_dev *dev, struct mt76_queue *q);
 void mt76_kick_queue(struct mt76_dev *dev, struct mt76_queue *q);
 
 void mt76_pre_tbtt_tasklet(unsigned long data);
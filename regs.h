@@ -126,6 +126,12 @@
 #define MT_WPDMA_RST_IDX		0x020c
 
 #define MT_WPDMA_DELAY_INT_CFG		0x0210
+#define MT_WPDMA_DELAY_INT_CFG_RX_MAX_PTIME	GENMASK(7, 0)
+#define MT_WPDMA_DELAY_INT_CFG_RX_MAX_PINT	GENMASK(14, 8)
+#define MT_WPDMA_DELAY_INT_CFG_RX_DLY_EN	BIT(15)
+#define MT_WPDMA_DELAY_INT_CFG_TX_MAX_PTIME	GENMASK(23, 16)
+#define MT_WPDMA_DELAY_INT_CFG_TX_MAX_PINT	GENMASK(30, 24)
+#define MT_WPDMA_DELAY_INT_CFG_TX_DLY_EN	BIT(31)
 
 #define MT_WMM_AIFSN		0x0214
 #define MT_WMM_AIFSN_MASK		GENMASK(3, 0)
@@ -192,6 +198,8 @@
 #define MT_FCE_PSE_CTRL			0x0800
 #define MT_FCE_PARAMETERS		0x0804
 #define MT_FCE_CSO			0x0808
+#define MT_FCE_CSO_TX			GENMASK(3, 0)
+#define MT_FCE_CSO_RX			GENMASK(9, 8)
 
 #define MT_FCE_L2_STUFF			0x080c
 #define MT_FCE_L2_STUFF_HT_L2_EN	BIT(0)
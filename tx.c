@@ -19,6 +19,17 @@ struct beacon_bc_data {
 	struct sk_buff *tail[8];
 };
 
+static void
+mt76_tx_info_init(struct mt76_dev *dev, struct sk_buff *skb)
+{
+	struct mt76_tx_info *txi = mt76_skb_tx_info(skb);
+	int overhead = mt76_mac_skb_tx_overhead(dev, skb);
+
+	memset(txi, 0, sizeof(*txi));
+	txi->jiffies = jiffies;
+	txi->overhead = overhead;
+}
+
 void mt76_tx(struct ieee80211_hw *hw, struct ieee80211_tx_control *control,
 	     struct sk_buff *skb)
 {
@@ -45,31 +56,118 @@ void mt76_tx(struct ieee80211_hw *hw, struct ieee80211_tx_control *control,
 		ieee80211_get_tx_rates(info->control.vif, control->sta, skb,
 				       info->control.rates, 1);
 
+	mt76_tx_info_init(dev, skb);
 	q = &dev->q_tx[qid];
 
-	spin_lock_bh(&q->lock);
+	mt76_queue_lock(q);
 	mt76_tx_queue_skb(dev, q, skb, wcid, control->sta);
 	mt76_kick_queue(dev, q);
 
-	if (q->queued > q->ndesc - 8)
+	if (q->queued > q->ndesc - 8 || dql_avail(&q->dql) < 0)
 		ieee80211_stop_queue(hw, skb_get_queue_mapping(skb));
-	spin_unlock_bh(&q->lock);
+	mt76_queue_unlock(q);
 }
 
+/* tx status has already been filled in from the matching TX_STAT_FIFO entry */
 void mt76_tx_complete(struct mt76_dev *dev, struct sk_buff *skb)
 {
 	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
-	struct mt76_queue *q;
-	int qid = skb_get_queue_mapping(skb);
 
-	ieee80211_tx_info_clear_status(info);
-	info->status.rates[0].idx = -1;
-	info->flags |= IEEE80211_TX_STAT_ACK;
+	if (mt76_skb_tx_info(skb)->retry &&
+	    (info->flags & IEEE80211_TX_STAT_ACK))
+		dev->tx_retry_recovered++;
+
 	ieee80211_tx_status(dev->hw, skb);
+}
 
-	q = &dev->q_tx[qid];
-	if (q->queued < q->ndesc - 8)
-		ieee80211_wake_queue(dev->hw, qid);
+bool mt76_tx_retry_check(struct mt76_dev *dev, struct sk_buff *skb)
+{
+	struct mt76_tx_info *txi = mt76_skb_tx_info(skb);
+
+	if (!(txi->flags & MT_TX_CB_RETRYABLE))
+		return false;
+
+	if (txi->retry >= MT_TX_SW_RETRY_MAX ||
+	    (s32) ((u32) jiffies - txi->jiffies) > MT_TX_SW_RETRY_TIMEOUT) {
+		dev->tx_retry_expired++;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Puts a QoS data frame that the hardware failed to deliver back in front
+ * of its station txq, marked as a retransmission. Only frames sent outside
+ * an A-MPDU are marked retryable, see mt76_mac_tx_status_add(). Returns
+ * false if the frame is out of retries, too old or its station is gone;
+ * the skb then still belongs to the caller.
+ * Must not be called with interrupts disabled.
+ */
+bool mt76_tx_retry(struct mt76_dev *dev, struct sk_buff *skb)
+{
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *) skb->data;
+	struct mt76_tx_info *txi = mt76_skb_tx_info(skb);
+	struct mt76_wcid *wcid = NULL;
+	struct ieee80211_sta *sta;
+	struct ieee80211_txq *txq;
+	void *msta;
+	struct mt76_txq *mtxq;
+	struct mt76_queue *hwq;
+	bool ret = false;
+	int hdrlen;
+	u8 tid;
+
+	if (!test_bit(MT76_STATE_RUNNING, &dev->state) ||
+	    !ieee80211_is_data_qos(hdr->frame_control))
+		return false;
+
+	if (!mt76_tx_retry_check(dev, skb))
+		return false;
+
+	rcu_read_lock();
+	if (txi->wcid < ARRAY_SIZE(dev->wcid))
+		wcid = rcu_dereference(dev->wcid[txi->wcid]);
+	if (!wcid)
+		goto out;
+
+	msta = container_of(wcid, struct mt76_sta, wcid);
+	sta = container_of(msta, struct ieee80211_sta, drv_priv);
+	tid = *ieee80211_get_qos_ctl(hdr) & IEEE80211_QOS_CTL_TID_MASK;
+	txq = sta->txq[tid];
+	if (!txq)
+		goto out;
+
+	hdrlen = ieee80211_get_hdrlen_from_skb(skb);
+	if (!dev->tx_l2_stuff && hdrlen % 4) {
+		mt76_remove_hdr_pad(skb);
+		hdr = (struct ieee80211_hdr *) skb->data;
+	}
+
+	mtxq = (struct mt76_txq *) txq->drv_priv;
+	hwq = mtxq->hwq;
+
+	mt76_queue_lock(hwq);
+	/* mt76_sta_remove clears the wcid before purging the txqs */
+	if (rcu_access_pointer(dev->wcid[txi->wcid]) == wcid) {
+		/*
+		 * The hardware assigns a new PN on every send, so the receiver
+		 * needs the Retry bit to drop the copy if only the ACK was lost.
+		 */
+		hdr->frame_control |= cpu_to_le16(IEEE80211_FCTL_RETRY);
+		txi->retry++;
+		skb_queue_tail(&mtxq->retry_q, skb);
+		if (list_empty(&mtxq->list))
+			list_add_tail(&mtxq->list, &hwq->swq);
+		mt76_txq_schedule(dev, hwq);
+		dev->tx_retry_requeued++;
+		ret = true;
+	}
+	mt76_queue_unlock(hwq);
+
+out:
+	rcu_read_unlock();
+	return ret;
 }
 
 static void
@@ -165,8 +263,11 @@ void mt76_pre_tbtt_tasklet(unsigned long arg)
 		struct ieee80211_vif *vif = info->control.vif;
 		struct mt76_vif *mvif = (struct mt76_vif *) vif->drv_priv;
 
+		mt76_tx_info_init(dev, skb);
 		mt76_tx_queue_skb(dev, q, skb, &mvif->group_wcid, NULL);
 	}
+	/* the TBTT interrupt rings the doorbell for these */
+	q->kick_pending = 0;
 	spin_unlock_bh(&q->lock);
 }
 
@@ -179,6 +280,62 @@ mt76_txq_get_qid(struct ieee80211_txq *txq)
 	return txq->ac;
 }
 
+static void
+mt76_txq_charge_airtime(struct mt76_txq *mtxq, struct mt76_queue *hwq,
+			int idx)
+{
+	u16 airtime = hwq->entry[idx].airtime;
+
+	mtxq->deficit -= airtime;
+	mtxq->airtime += airtime;
+}
+
+/* frames put back by the scheduler or a software retry go out first */
+static struct sk_buff *
+mt76_txq_dequeue(struct mt76_dev *dev, struct mt76_txq *mtxq)
+{
+	struct ieee80211_txq *txq = mtxq_to_txq(mtxq);
+	struct sk_buff *skb;
+
+	skb = skb_dequeue(&mtxq->retry_q);
+	if (skb)
+		return skb;
+
+	skb = ieee80211_tx_dequeue(dev->hw, txq);
+	if (IS_ERR_OR_NULL(skb))
+		return NULL;
+
+	mt76_tx_info_init(dev, skb);
+	return skb;
+}
+
+/*
+ * Number of frames to queue per burst: as many as fit into the target
+ * airtime at the rate of the first frame, capped by the BA window. For
+ * A-MPDUs the limit is rounded down to a multiple of the average A-MPDU
+ * length seen by the hardware, so that bursts do not leave a short
+ * trailing aggregate behind.
+ */
+static int
+mt76_txq_burst_limit(struct mt76_dev *dev, struct ieee80211_sta *sta,
+		     struct mt76_txwi *txwi, bool ampdu)
+{
+	u32 airtime, aggr_len = dev->aggr_len;
+	int limit;
+
+	airtime = mt76_mac_tx_airtime(txwi->rate, MT_TX_BURST_MPDU_LEN, ampdu);
+	limit = dev->burst_airtime / max_t(u32, airtime, 1);
+
+	if (!ampdu || !sta)
+		return clamp_t(int, limit, 1, MT_TX_BURST_LEGACY_MAX);
+
+	limit = clamp_t(int, limit, 1, mt76_mac_ba_size(sta));
+	if (aggr_len > 1 && limit > aggr_len)
+		limit -= limit % aggr_len;
+
+	return limit;
+}
+
 static int
 mt76_txq_send_burst(struct mt76_dev *dev, struct mt76_queue *hwq,
 		    struct mt76_txq *mtxq, bool *empty)
@@ -191,7 +348,7 @@ mt76_txq_send_burst(struct mt76_dev *dev, struct mt76_queue *hwq,
 	struct ieee80211_tx_rate tx_rate;
 	bool ampdu;
 	bool probe;
-	int idx;
+	int idx, debt;
 
 	if (txq->sta) {
 		struct mt76_sta *sta = (struct mt76_sta *) txq->sta->drv_priv;
@@ -201,12 +358,16 @@ mt76_txq_send_burst(struct mt76_dev *dev, struct mt76_queue *hwq,
 		wcid = &mvif->group_wcid;
 	}
 
-	skb = ieee80211_tx_dequeue(dev->hw, txq);
-	if (IS_ERR_OR_NULL(skb)) {
+	skb = mt76_txq_dequeue(dev, mtxq);
+	if (!skb) {
 		*empty = true;
 		return 0;
 	}
 
+	debt = atomic_xchg(&wcid->airtime_debt[txq->ac], 0);
+	mtxq->deficit -= debt;
+	mtxq->airtime += debt;
+
 	info = IEEE80211_SKB_CB(skb);
 	if (!wcid->tx_rate_set)
 		ieee80211_get_tx_rates(txq->vif, txq->sta, skb,
@@ -215,72 +376,130 @@ mt76_txq_send_burst(struct mt76_dev *dev, struct mt76_queue *hwq,
 
 	probe = (info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE);
 	ampdu = IEEE80211_SKB_CB(skb)->flags & IEEE80211_TX_CTL_AMPDU;
-	limit = ampdu ? 16 : 3;
 	idx = mt76_tx_queue_skb(dev, hwq, skb, wcid, txq->sta);
 
 	if (idx < 0)
 		return idx;
 
-	do {
+	mt76_txq_charge_airtime(mtxq, hwq, idx);
+	limit = mt76_txq_burst_limit(dev, txq->sta, hwq->entry[idx].txwi,
+				     ampdu);
+
+	while (n_frames < limit) {
 		bool cur_ampdu;
 
-		if (probe)
+		if (probe || hwq->queued >= hwq->ndesc - 8)
 			break;
 
-		skb = ieee80211_tx_dequeue(dev->hw, txq);
-		if (IS_ERR_OR_NULL(skb)) {
+		skb = mt76_txq_dequeue(dev, mtxq);
+		if (!skb) {
 			*empty = true;
 			break;
 		}
 
+		info = IEEE80211_SKB_CB(skb);
 		cur_ampdu = info->flags & IEEE80211_TX_CTL_AMPDU;
 
 		if (ampdu != cur_ampdu ||
 		    (info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE)) {
-			skb_queue_tail(&mtxq->retry_q, skb);
+			skb_queue_head(&mtxq->retry_q, skb);
 			break;
 		}
 
-		info = IEEE80211_SKB_CB(skb);
 		info->control.rates[0] = tx_rate;
 
 		idx = mt76_tx_queue_skb(dev, hwq, skb, wcid, txq->sta);
 		if (idx < 0)
 			return idx;
 
+		mt76_txq_charge_airtime(mtxq, hwq, idx);
 		n_frames++;
-	} while (n_frames < limit);
+	}
 
 	if (!probe) {
 		hwq->swq_queued++;
 		hwq->entry[idx].schedule = true;
 	}
 
-	mt76_kick_queue(dev, hwq);
-
 	return n_frames;
 }
 
+/*
+ * Airtime queue limit: a station may only have its low limit of airtime in
+ * flight while the device as a whole is busy, and the high limit otherwise.
+ */
+static bool
+mt76_txq_aql_throttled(struct mt76_dev *dev, struct mt76_queue *hwq,
+		       struct mt76_txq *mtxq)
+{
+	struct ieee80211_txq *txq = mtxq_to_txq(mtxq);
+	struct mt76_sta *msta;
+	int ac = hwq - dev->q_tx;
+	u32 limit;
+
+	if (!txq->sta || ac >= IEEE80211_NUM_ACS)
+		return false;
+
+	msta = (struct mt76_sta *) txq->sta->drv_priv;
+	if (atomic_read(&dev->aql_pending[ac]) < (int) dev->aql_threshold)
+		limit = dev->aql_limit_high[ac];
+	else
+		limit = dev->aql_limit_low[ac];
+
+	if (atomic_read(&msta->wcid.airtime_pending[ac]) < (int) limit)
+		return false;
+
+	dev->aql_throttled[ac]++;
+	return true;
+}
+
 static int
 mt76_txq_schedule_list(struct mt76_dev *dev, struct mt76_queue *hwq)
 {
-	struct mt76_txq *mtxq, *mtxq_last;
+	struct mt76_txq *mtxq, *mtxq_last, *throttled = NULL;
 	int len = 0;
 
 	mtxq_last = list_last_entry(&hwq->swq, struct mt76_txq, list);
 	while (1) {
 		bool empty = false;
-		int cur, len;
+		int cur;
 
-		if (hwq->swq_queued >= 4)
+		if (hwq->swq_queued >= 4 || dql_avail(&hwq->dql) < 0 ||
+		    hwq->queued >= hwq->ndesc - 8)
 			break;
 
 		if (list_empty(&hwq->swq))
 			break;
 
 		mtxq = list_first_entry(&hwq->swq, struct mt76_txq, list);
+
+		/* stop once a full pass found only throttled stations */
+		if (mt76_txq_aql_throttled(dev, hwq, mtxq)) {
+			if (mtxq == throttled)
+				break;
+
+			if (!throttled)
+				throttled = mtxq;
+
+			list_move_tail(&mtxq->list, &hwq->swq);
+			continue;
+		}
+
+		/*
+		 * Deficit round robin on estimated airtime: a txq that used up
+		 * its share gets a new quantum and waits for the next round.
+		 */
+		if (mtxq->deficit <= 0) {
+			mtxq->deficit += MT_TXQ_AIRTIME_QUANTUM;
+			list_move_tail(&mtxq->list, &hwq->swq);
+			/* a refill is progress, not a throttled pass */
+			throttled = NULL;
+			continue;
+		}
+
 		list_del_init(&mtxq->list);
 
+		throttled = NULL;
 		cur = mt76_txq_send_burst(dev, hwq, mtxq, &empty);
 		if (!empty)
 			list_add_tail(&mtxq->list, &hwq->swq);
@@ -290,6 +509,10 @@ mt76_txq_schedule_list(struct mt76_dev *dev, struct mt76_queue *hwq)
 
 		len += cur;
 
+		/* don't let a long round hold back the doorbell */
+		if (hwq->kick_pending >= MT_TX_KICK_BATCH)
+			mt76_kick_queue(dev, hwq);
+
 		if (mtxq == mtxq_last)
 			break;
 	}
@@ -304,6 +527,8 @@ void mt76_txq_schedule(struct mt76_dev *dev, struct mt76_queue *hwq)
 	do {
 	    len = mt76_txq_schedule_list(dev, hwq);
 	} while (len > 0);
+
+	mt76_kick_queue(dev, hwq);
 }
 
 void mt76_txq_init(struct mt76_dev *dev, struct ieee80211_txq *txq)
@@ -326,17 +551,18 @@ void mt76_wake_tx_queue(struct ieee80211_hw *hw, struct ieee80211_txq *txq)
 	struct mt76_txq *mtxq = (struct mt76_txq *) txq->drv_priv;
 	struct mt76_queue *hwq = mtxq->hwq;
 
-	spin_lock_bh(&hwq->lock);
+	mt76_queue_lock(hwq);
 	if (list_empty(&mtxq->list))
 		list_add_tail(&mtxq->list, &hwq->swq);
 	mt76_txq_schedule(dev, hwq);
-	spin_unlock_bh(&hwq->lock);
+	mt76_queue_unlock(hwq);
 }
 
 void mt76_txq_remove(struct mt76_dev *dev, struct ieee80211_txq *txq)
 {
 	struct mt76_txq *mtxq;
 	struct mt76_queue *hwq;
+	struct sk_buff *skb;
 
 	if (!txq)
 		return;
@@ -346,6 +572,9 @@ void mt76_txq_remove(struct mt76_dev *dev, struct ieee80211_txq *txq)
 
 	spin_lock_bh(&hwq->lock);
 	if (!list_empty(&mtxq->list))
-		list_del(&mtxq->list);
+		list_del_init(&mtxq->list);
 	spin_unlock_bh(&hwq->lock);
+
+	while ((skb = skb_dequeue(&mtxq->retry_q)) != NULL)
+		ieee80211_free_txskb(dev->hw, skb);
 }